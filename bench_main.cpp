@@ -0,0 +1,2185 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cctype>
+#include <atomic>
+#include <new>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "kissnet.h"
+#include "crossword_room.h"
+#include "crossword_server.h"
+#include "crossword_protocol.h"
+#include "frame_reader.h"
+#include "move_journal.h"
+#include "game_recording.h"
+
+#define BENCH_PORT "3334"
+
+// Every allocation in the process, server threads included, for the allocs
+// benchmark
+static std::atomic<long> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+static double now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1));
+    return samples[idx];
+}
+
+// Each connection needs two descriptors on loopback, make sure we can have them
+static void raise_fd_limit()
+{
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+// Peak resident set size in bytes
+static long peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+}
+
+// Reads everything buffered on a socket, returns the number of bytes read
+static int drain(kissnet::tcp_socket *sock)
+{
+    char buf[512];
+    int total = 0;
+    int bytes;
+    while ((bytes = sock->recv(buf, sizeof(buf))) > 0)
+        total += bytes;
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+// socket_set wakeup benchmark
+// -----------------------------------------------------------------------------
+struct loopback_pairs
+{
+    kissnet::tcp_socket listener;
+    std::vector<kissnet::tcp_socket*> clients;
+    std::vector<kissnet::tcp_socket*> servers;
+    kissnet::socket_set set;
+
+    loopback_pairs(int n)
+    {
+        listener.listen(BENCH_PORT, 128);
+        for (int i = 0; i < n; i++)
+        {
+            kissnet::tcp_socket *client = new kissnet::tcp_socket();
+            client->connect("127.0.0.1", BENCH_PORT);
+            clients.push_back(client);
+
+            kissnet::tcp_socket *server = listener.accept();
+            server->set_nonblocking(true);
+            servers.push_back(server);
+            set.add_socket(server);
+        }
+    }
+
+    ~loopback_pairs()
+    {
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            delete clients[i];
+            delete servers[i];
+        }
+    }
+};
+
+// One connection sends, the rest sit idle.  Measures how long a wakeup takes
+// to come back from the set as the number of registered sockets grows.
+static void bench_idle(loopback_pairs& pairs, int rounds)
+{
+    std::vector<double> samples;
+    const std::string ping("x");
+    kissnet::tcp_socket *client = pairs.clients[0];
+
+    for (int i = 0; i < rounds; i++)
+    {
+        double start = now_usec();
+        client->send(ping);
+        std::vector<kissnet::tcp_socket*> ready = pairs.set.poll_sockets();
+        for (size_t j = 0; j < ready.size(); j++)
+            drain(ready[j]);
+        samples.push_back(now_usec() - start);
+    }
+
+    double p50 = percentile(samples, 0.50);
+    double p99 = percentile(samples, 0.99);
+    std::cout << std::setw(8) << pairs.clients.size() << "  idle    "
+        << "p50 " << std::setw(8) << p50 << " us  p99 " << std::setw(8) << p99
+        << " us  " << std::setw(10) << (p50 > 0 ? 1e6 / p50 : 0) << " msg/s\n";
+}
+
+// Every connection sends each round, the set has to report all of them.
+static void bench_active(loopback_pairs& pairs, int rounds)
+{
+    std::vector<double> samples;
+    const std::string ping("x");
+    int n = pairs.clients.size();
+    double total = 0;
+
+    for (int i = 0; i < rounds; i++)
+    {
+        for (int j = 0; j < n; j++)
+            pairs.clients[j]->send(ping);
+
+        double start = now_usec();
+        int received = 0;
+        bool first = true;
+        while (received < n)
+        {
+            std::vector<kissnet::tcp_socket*> ready = pairs.set.poll_sockets();
+            if (first)
+            {
+                samples.push_back(now_usec() - start);
+                first = false;
+            }
+            for (size_t j = 0; j < ready.size(); j++)
+                received += drain(ready[j]);
+        }
+        total += now_usec() - start;
+    }
+
+    double p50 = percentile(samples, 0.50);
+    double p99 = percentile(samples, 0.99);
+    std::cout << std::setw(8) << n << "  active  "
+        << "p50 " << std::setw(8) << p50 << " us  p99 " << std::setw(8) << p99
+        << " us  " << std::setw(10) << (total > 0 ? n * rounds * 1e6 / total : 0)
+        << " msg/s\n";
+}
+
+static int bench_net(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for (int i = 0; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+    if (sizes.empty())
+    {
+        sizes.push_back(10);
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+    }
+
+    raise_fd_limit();
+
+    kissnet::socket_set probe;
+    std::cout << "socket_set backend: "
+        << (probe.edge_triggered() ? "epoll (edge triggered)" : "select") << '\n';
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        try
+        {
+            loopback_pairs pairs(sizes[i]);
+            bench_idle(pairs, 2000);
+            bench_active(pairs, std::max(10, 20000 / sizes[i]));
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            std::cout << std::setw(8) << sizes[i] << "  skipped: " << e.what() << '\n';
+        }
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Memory per idle room
+// -----------------------------------------------------------------------------
+static int bench_rooms(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "rooms needs a crossword file\n";
+        return -1;
+    }
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+
+    std::ifstream infile(argv[0]);
+    std::stringstream xml;
+    xml << infile.rdbuf();
+
+    crossword_board puzzle;
+    puzzle.read(xml);
+
+    // Rooms copy the puzzle and share its layout, answers and clues
+    std::vector<crossword_room*> rooms;
+    rooms.reserve(count);
+    long before = peak_rss();
+    for (int i = 0; i < count; i++)
+    {
+        std::ostringstream id;
+        id << "room" << i;
+        rooms.push_back(new crossword_room(id.str(), puzzle));
+    }
+    long shared = peak_rss() - before;
+
+    // For comparison, every room reading its own copy of the puzzle
+    std::vector<crossword_board*> boards;
+    boards.reserve(count);
+    before = peak_rss();
+    for (int i = 0; i < count; i++)
+    {
+        xml.clear();
+        xml.seekg(0);
+        boards.push_back(new crossword_board());
+        boards.back()->read(xml);
+    }
+    long unshared = peak_rss() - before;
+
+    std::cout << count << " rooms of a " << puzzle.xdim() << 'x' << puzzle.ydim()
+        << " puzzle\n"
+        << "  shared puzzle:   " << shared / count << " bytes per room\n"
+        << "  unshared puzzle: " << unshared / count << " bytes per room\n";
+
+    for (int i = 0; i < count; i++)
+    {
+        delete rooms[i];
+        delete boards[i];
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Win check cost per keystroke
+// -----------------------------------------------------------------------------
+// Makes a size x size puzzle with a wall in every seventh cell, an unknown
+// answer in every eleventh and a digit in every thirteenth.  The last cell
+// is always a letter.
+static std::string make_puzzle_xml(int size)
+{
+    std::string answers;
+    for (int i = 0; i < size * size; i++)
+    {
+        char answer = static_cast<char>('A' + i % 26);
+        if (i == size * size - 1)
+            ;
+        else if (i % 7 == 6)
+            answer = '-';
+        else if (i % 11 == 10)
+            answer = ' ';
+        else if (i % 13 == 12)
+            answer = '1';
+        answers.push_back(answer);
+    }
+
+    std::ostringstream xml;
+    xml << "<crossword><Width v=\"" << size << "\" /><Height v=\"" << size
+        << "\" /><AllAnswer v=\"" << answers << "\" /></crossword>";
+    return xml.str();
+}
+
+// The check won() did before it kept count, a scan of the whole grid
+static bool scan_won(const crossword_board& board)
+{
+    for (int y = 0; y < board.ydim(); y++)
+    {
+        for (int x = 0; x < board.xdim(); x++)
+        {
+            char answer = board.answer_at(x, y);
+            if (board.at(x, y) != answer && (isalpha(answer) || answer == ' '))
+                return false;
+        }
+    }
+    return true;
+}
+
+static int bench_won(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for (int i = 0; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+    if (sizes.empty())
+    {
+        sizes.push_back(15);
+        sizes.push_back(21);
+        sizes.push_back(100);
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        std::istringstream xml(make_puzzle_xml(sizes[i]));
+        crossword_board board;
+        board.read(xml);
+
+        // Solve everything except the last cell, the scan has to look at the
+        // whole grid before it finds that one
+        int n = board.xdim() * board.ydim();
+        for (int j = 0; j < n - 1; j++)
+            board.set_at(j % board.xdim(), j / board.xdim(),
+                    board.answer_at(j % board.xdim(), j / board.xdim()));
+
+        // Each keystroke is an update followed by a win check
+        const int rounds = 200000;
+        int x = 0, y = 0;
+        long wins = 0;
+        double start = now_usec();
+        for (int j = 0; j < rounds; j++)
+        {
+            board.set_at(x, y, board.answer_at(x, y));
+            wins += scan_won(board);
+        }
+        double scan = (now_usec() - start) * 1e3 / rounds;
+
+        start = now_usec();
+        for (int j = 0; j < rounds; j++)
+        {
+            board.set_at(x, y, board.answer_at(x, y));
+            wins += board.won();
+        }
+        double counted = (now_usec() - start) * 1e3 / rounds;
+
+        // Unknown answers are right while blank, so the last letter wins
+        board.set_at((n - 1) % board.xdim(), (n - 1) / board.xdim(),
+                board.answer_at((n - 1) % board.xdim(), (n - 1) / board.xdim()));
+        bool won = board.won() && scan_won(board);
+
+        std::cout << std::setw(4) << sizes[i] << 'x' << std::left << std::setw(4)
+            << sizes[i] << std::right << "  scan " << std::setw(9) << scan
+            << " ns  counted " << std::setw(6) << counted << " ns"
+            << (wins ? "  (unexpected win)" : "") << (won ? "" : "  (can't win)") << '\n';
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Whole grid scans, loads and copies of the cell storage
+// -----------------------------------------------------------------------------
+static int bench_cells(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for (int i = 0; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+    if (sizes.empty())
+    {
+        sizes.push_back(15);
+        sizes.push_back(100);
+        sizes.push_back(400);
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        std::istringstream xml(make_puzzle_xml(sizes[i]));
+        crossword_board board;
+        board.read(xml);
+        // Solved, so the scan goes all the way through
+        for (int y = 0; y < board.ydim(); y++)
+            for (int x = 0; x < board.xdim(); x++)
+                board.set_at(x, y, board.answer_at(x, y));
+        std::string binary;
+        board.write_binary(binary);
+        long cells = static_cast<long>(board.xdim()) * board.ydim();
+        int rounds = std::max(1L, 20000000 / cells);
+
+        // Letters against answers, as the old win check and error
+        // highlighting do
+        long found = 0;
+        double start = now_usec();
+        for (int r = 0; r < rounds; r++)
+            found += scan_won(board);
+        double scan = (now_usec() - start) * 1e3 / rounds / cells;
+
+        // Walls and clue numbers, as a redraw does
+        start = now_usec();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (int y = 0; y < board.ydim(); y++)
+                for (int x = 0; x < board.xdim(); x++)
+                    found += board.layout_at(x, y) == crossword_board::wall_char;
+        }
+        double layout = (now_usec() - start) * 1e3 / rounds / cells;
+
+        // Loading indexes the words and counts the wrong cells
+        int loads = std::max(1, rounds / 100);
+        long allocs = allocations.load();
+        start = now_usec();
+        for (int r = 0; r < loads; r++)
+        {
+            crossword_board loaded;
+            loaded.read_binary(binary.data(), binary.size());
+        }
+        double load = (now_usec() - start) / loads;
+        allocs = (allocations.load() - allocs) / loads;
+
+        // A room's board is a copy of the library's, then moved into place
+        start = now_usec();
+        for (int r = 0; r < loads; r++)
+        {
+            crossword_board copy(board);
+            crossword_board moved(std::move(copy));
+            found += moved.won();
+        }
+        double copy = (now_usec() - start) / loads;
+
+        std::cout << std::setw(4) << sizes[i] << 'x' << std::left << std::setw(4)
+            << sizes[i] << std::right << "  scan " << std::setw(5) << scan
+            << " ns/cell  layout " << std::setw(5) << layout
+            << " ns/cell  load " << std::setw(9) << load << " us ("
+            << allocs << " allocs)  copy+move " << std::setw(8) << copy << " us"
+            << (found < 0 ? "!" : "") << '\n';
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Progress counts and mistakes, per kernel
+// -----------------------------------------------------------------------------
+// What the client did per redraw before there were kernels
+static board_progress scan_progress(const crossword_board& board, std::vector<bool>& wrong)
+{
+    board_progress p = { 0, 0, 0 };
+    for (int y = 0; y < board.ydim(); y++)
+    {
+        for (int x = 0; x < board.xdim(); x++)
+        {
+            char answer = board.answer_at(x, y), letter = board.at(x, y);
+            // The easy mode rule
+            wrong[y * board.xdim() + x] = letter != ' ' && answer != ' ' && letter != answer;
+            if (!isalpha(answer) && answer != ' ')
+                continue;
+            p.cells++;
+            p.filled += letter != ' ';
+            p.correct += letter == answer;
+        }
+    }
+    return p;
+}
+
+static int bench_progress(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for (int i = 0; i < argc; i++)
+        sizes.push_back(atoi(argv[i]));
+    if (sizes.empty())
+    {
+        sizes.push_back(15);
+        sizes.push_back(100);
+        sizes.push_back(1000);
+    }
+
+    std::string best = crossword_board::kernel();
+    const char *names[] = { "scalar", "sse2", "avx2" };
+    std::cout << "best kernel " << best << '\n' << std::fixed << std::setprecision(2);
+    bool ok = true;
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        std::istringstream xml(make_puzzle_xml(sizes[i]));
+        crossword_board board;
+        board.read(xml);
+        // Two thirds filled in, every fifth of those wrong
+        for (int y = 0; y < board.ydim(); y++)
+        {
+            for (int x = 0; x < board.xdim(); x++)
+            {
+                int n = y * board.xdim() + x;
+                if (n % 3 == 2)
+                    continue;
+                char answer = board.answer_at(x, y);
+                board.set_at(x, y, n % 5 == 0 ? (answer == 'Z' ? 'A' : answer + 1) : answer);
+            }
+        }
+        long cells = static_cast<long>(board.xdim()) * board.ydim();
+        int rounds = std::max(1L, 50000000 / cells);
+
+        std::vector<bool> wrong(cells);
+        double start = now_usec();
+        board_progress expect = { 0, 0, 0 };
+        for (int r = 0; r < rounds; r++)
+            expect = scan_progress(board, wrong);
+        double scan = (now_usec() - start) * 1e3 / rounds / cells;
+        std::cout << std::setw(4) << sizes[i] << 'x' << std::left << std::setw(4)
+            << sizes[i] << std::right << "  accessors " << std::setw(6) << scan << " ns/cell";
+
+        for (int k = 0; k < 3; k++)
+        {
+            if (!crossword_board::select_kernel(names[k]))
+                continue;
+
+            std::vector<uint64_t> mistakes;
+            board_progress p = { 0, 0, 0 };
+            start = now_usec();
+            for (int r = 0; r < rounds; r++)
+                p = board.progress(&mistakes);
+            double per_cell = (now_usec() - start) * 1e3 / rounds / cells;
+            std::cout << "  " << names[k] << ' ' << std::setw(5) << per_cell << " ns/cell";
+
+            bool same = p.cells == expect.cells && p.filled == expect.filled &&
+                p.correct == expect.correct;
+            for (long c = 0; c < cells; c++)
+                same = same && ((mistakes[c / 64] >> (c % 64) & 1) != 0) == wrong[c];
+            if (!same)
+            {
+                std::cout << " (disagrees)";
+                ok = false;
+            }
+        }
+        std::cout << "  " << 100.0 * expect.correct / expect.cells << "% done\n";
+    }
+    crossword_board::select_kernel(best);
+
+    return ok ? 0 : 1;
+}
+
+// -----------------------------------------------------------------------------
+// Board encode/decode, XML against binary
+// -----------------------------------------------------------------------------
+static void bench_board_one(const std::string& name, const crossword_board& board,
+        int rounds)
+{
+    std::string xml, binary;
+    double start = now_usec();
+    for (int i = 0; i < rounds; i++)
+    {
+        std::ostringstream out;
+        board.write(out);
+        xml = out.str();
+    }
+    double xml_encode = (now_usec() - start) / rounds;
+
+    start = now_usec();
+    for (int i = 0; i < rounds; i++)
+    {
+        std::istringstream in(xml);
+        crossword_board copy;
+        copy.read(in);
+    }
+    double xml_decode = (now_usec() - start) / rounds;
+
+    start = now_usec();
+    for (int i = 0; i < rounds; i++)
+    {
+        binary.clear();
+        board.write_binary(binary);
+    }
+    double binary_encode = (now_usec() - start) / rounds;
+
+    start = now_usec();
+    for (int i = 0; i < rounds; i++)
+    {
+        crossword_board copy;
+        copy.read_binary(binary.data(), binary.size());
+    }
+    double binary_decode = (now_usec() - start) / rounds;
+
+    std::cout << name << '\n'
+        << "  xml     " << std::setw(8) << xml.size() << " bytes  encode "
+        << std::setw(8) << xml_encode << " us  decode " << std::setw(8)
+        << xml_decode << " us\n"
+        << "  binary  " << std::setw(8) << binary.size() << " bytes  encode "
+        << std::setw(8) << binary_encode << " us  decode " << std::setw(8)
+        << binary_decode << " us\n";
+}
+
+static int bench_board(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    std::cout << std::fixed << std::setprecision(1);
+
+    if (argc > 0)
+    {
+        std::ifstream infile(argv[0]);
+        crossword_board board;
+        board.read(infile);
+        bench_board_one(argv[0], board, rounds);
+    }
+
+    std::istringstream xml(make_puzzle_xml(100));
+    crossword_board jumbo;
+    jumbo.read(xml);
+    bench_board_one("100x100 without clues", jumbo, std::max(1, rounds / 10));
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Join storm, every join encoding the board
+// -----------------------------------------------------------------------------
+static int bench_joins(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "joins needs a crossword file\n";
+        return -1;
+    }
+    int joins = argc > 1 ? atoi(argv[1]) : 1000;
+
+    std::ifstream infile(argv[0]);
+    crossword_board puzzle;
+    puzzle.read(infile);
+    crossword_room room("storm", puzzle);
+    const crossword_board& board = room.board();
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (int binary = 0; binary < 2; binary++)
+    {
+        double start = now_usec();
+        for (int i = 0; i < joins; i++)
+        {
+            std::string data;
+            if (binary)
+                board.write_binary(data);
+            else
+            {
+                std::ostringstream out;
+                board.write(out);
+                data = out.str();
+            }
+        }
+        double full = now_usec() - start;
+
+        start = now_usec();
+        for (int i = 0; i < joins; i++)
+        {
+            std::string data;
+            board.write_snapshot(data, binary);
+        }
+        double cached = now_usec() - start;
+
+        std::cout << (binary ? "binary" : "xml   ") << "  " << joins
+            << " joins  encoded each time " << std::setw(9) << full / 1e3
+            << " ms  cached " << std::setw(7) << cached / 1e3 << " ms\n";
+    }
+
+    long hits, misses;
+    crossword_board::snapshot_stats(hits, misses);
+    std::cout << "snapshot cache: " << hits << " hits, " << misses << " misses\n";
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// UPDATE throughput as event loops are added
+// -----------------------------------------------------------------------------
+// Reads exactly len bytes from a blocking socket
+static void recv_all(kissnet::tcp_socket *sock, char *buf, int len)
+{
+    while (len > 0)
+    {
+        int bytes = sock->recv(buf, len);
+        if (bytes <= 0)
+            throw kissnet::socket_exception("Connection closed by the server");
+        buf += bytes;
+        len -= bytes;
+    }
+}
+
+// Reads one frame with either header size, returns the whole frame size
+static int read_frame(kissnet::tcp_socket *sock, int& type, std::vector<char>& payload)
+{
+    unsigned char header[EXTENDED_HEADER_SIZE];
+    recv_all(sock, reinterpret_cast<char*>(header), HEADER_SIZE);
+    int header_size = HEADER_SIZE;
+    int size = header[1] * 256 + header[2];
+    if (header[0] & EXTENDED_FLAG)
+    {
+        recv_all(sock, reinterpret_cast<char*>(header) + HEADER_SIZE, 2);
+        header_size = EXTENDED_HEADER_SIZE;
+        size = (size << 16) + header[3] * 256 + header[4];
+    }
+
+    type = header[0] & ~EXTENDED_FLAG;
+    payload.resize(size);
+    if (size > 0)
+        recv_all(sock, &payload[0], size);
+    return header_size + size;
+}
+
+// Connects to the bench server, joins a room and reads the board.  A protocol
+// version is announced if one is given, and flags if there are any.
+static kissnet::tcp_socket *join(const std::string& room_id, int protocol = 0,
+        int flags = 0)
+{
+    kissnet::tcp_socket *sock = new kissnet::tcp_socket();
+    sock->connect("127.0.0.1", BENCH_PORT);
+
+    std::string payload = room_id;
+    if (protocol > 0)
+    {
+        payload.push_back('\0');
+        payload.push_back(0);
+        payload.push_back(static_cast<char>(protocol));
+        if (flags)
+            payload.push_back(static_cast<char>(flags));
+    }
+    std::string request;
+    request.push_back(static_cast<char>(BOARD_REQUEST_TYPE));
+    request.push_back(static_cast<char>(payload.size() / 256));
+    request.push_back(static_cast<char>(payload.size() % 256));
+    request.append(payload);
+    sock->send(request);
+
+    int type;
+    std::vector<char> board;
+    read_frame(sock, type, board);
+
+    return sock;
+}
+
+// Every connection sends a batch of updates, then reads back the batches of
+// everyone in its room.  Returns the number of updates sent.
+static long drive_players(const std::vector<kissnet::tcp_socket*>& socks,
+        int per_room, int batch, int xdim, int ydim, double deadline)
+{
+    std::string updates;
+    for (int i = 0; i < batch; i++)
+    {
+        updates.push_back(static_cast<char>(UPDATE_TYPE));
+        updates.push_back(0);
+        updates.push_back(3);
+        updates.push_back(static_cast<char>(i % xdim));
+        updates.push_back(static_cast<char>(i / xdim % ydim));
+        // Never an answer, so nobody wins
+        updates.push_back('?');
+    }
+    std::vector<char> echoes(updates.size() * per_room);
+
+    long sent = 0;
+    while (now_usec() < deadline)
+    {
+        for (size_t i = 0; i < socks.size(); i++)
+            socks[i]->send(updates);
+        for (size_t i = 0; i < socks.size(); i++)
+            recv_all(socks[i], &echoes[0], echoes.size());
+        sent += static_cast<long>(batch) * socks.size();
+    }
+    return sent;
+}
+
+static void bench_shards_run(puzzle_library& puzzles, const crossword_board& puzzle,
+        int loops, int nrooms, int per_room, int batch, double seconds)
+{
+    server_pool pool(puzzles, BENCH_PORT, send_limits(), loops);
+    std::thread server(&server_pool::run, &pool);
+
+    // Give the first loop a moment to start listening
+    std::vector<kissnet::tcp_socket*> socks;
+    for (int attempt = 0; socks.empty(); attempt++)
+    {
+        try
+        {
+            socks.push_back(join("room0"));
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    for (int i = 1; i < nrooms * per_room; i++)
+    {
+        std::ostringstream id;
+        id << "room" << i / per_room;
+        socks.push_back(join(id.str()));
+    }
+
+    // As many client threads as event loops, each driving whole rooms
+    std::vector<std::vector<kissnet::tcp_socket*> > shares(loops);
+    for (int i = 0; i < nrooms; i++)
+        for (int j = 0; j < per_room; j++)
+            shares[i % loops].push_back(socks[i * per_room + j]);
+
+    std::vector<long> sent(loops);
+    std::vector<std::thread> clients;
+    double start = now_usec();
+    double deadline = start + seconds * 1e6;
+    for (int i = 0; i < loops; i++)
+    {
+        clients.push_back(std::thread([&, i]() {
+            sent[i] = drive_players(shares[i], per_room, batch,
+                    puzzle.xdim(), puzzle.ydim(), deadline);
+        }));
+    }
+    for (int i = 0; i < loops; i++)
+        clients[i].join();
+    double elapsed = now_usec() - start;
+
+    long total = 0;
+    for (int i = 0; i < loops; i++)
+        total += sent[i];
+
+    for (size_t i = 0; i < socks.size(); i++)
+        delete socks[i];
+    pool.stop();
+    server.join();
+
+    std::cout << std::setw(8) << loops << " loops  "
+        << std::setw(12) << total * 1e6 / elapsed << " updates/s  "
+        << std::setw(12) << total * per_room * 1e6 / elapsed << " deliveries/s\n";
+}
+
+static int bench_shards(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "shards needs a crossword file\n";
+        return -1;
+    }
+
+    // The clients need cores too, by default leave them half
+    int max_loops = argc > 1 ? atoi(argv[1]) :
+        std::max(1u, std::thread::hardware_concurrency() / 2);
+    int nrooms = argc > 2 ? atoi(argv[2]) : 64;
+    const int per_room = 2;
+    const int batch = 32;
+    const double seconds = 2;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    raise_fd_limit();
+
+    std::cout << nrooms << " rooms of " << per_room << " players, batches of "
+        << batch << " updates\n" << std::fixed << std::setprecision(0);
+
+    std::vector<int> counts;
+    for (int loops = 1; loops < max_loops; loops *= 2)
+        counts.push_back(loops);
+    counts.push_back(max_loops);
+
+    for (size_t i = 0; i < counts.size(); i++)
+        bench_shards_run(puzzles, puzzle, counts[i], nrooms, per_room, batch, seconds);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Solve word traffic with and without update batches
+// -----------------------------------------------------------------------------
+static int bench_solve(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "solve needs a crossword file\n";
+        return -1;
+    }
+    int npeers = argc > 1 ? atoi(argv[1]) : 8;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    // Protocol 2 clients get an UPDATE per letter, 3 gets batches.  Once the
+    // across words are solved the board is won and every later word also
+    // brings a WIN frame.
+    std::cout << std::fixed << std::setprecision(1);
+    for (int protocol = 2; protocol <= 3; protocol++)
+    {
+        crossword_server serv(puzzles, BENCH_PORT, send_limits());
+        std::thread server(&crossword_server::run, &serv);
+
+        std::vector<kissnet::tcp_socket*> peers;
+        for (int attempt = 0; peers.empty(); attempt++)
+        {
+            try
+            {
+                peers.push_back(join("", protocol));
+            }
+            catch (kissnet::socket_exception& e)
+            {
+                if (attempt == 100)
+                    throw;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        for (int i = 1; i < npeers; i++)
+            peers.push_back(join("", protocol));
+
+        // Solve every word one at a time, every peer reads all of its letters
+        long words = 0, frames = 0, bytes = 0;
+        double start = now_usec();
+        for (int dir = crossword_board::across_dir; dir <= crossword_board::down_dir; dir++)
+        {
+            const clue_set& clues = puzzle.clues(dir);
+            for (clue_set::const_iterator it = clues.begin(); it != clues.end(); it++)
+            {
+                int id = puzzle.word_of_clue(dir, it->first);
+                if (id < 0 || it->first > 127)
+                    continue;
+
+                std::string request;
+                request.push_back(static_cast<char>(SOLVE_WORD_TYPE));
+                request.push_back(0);
+                request.push_back(2);
+                request.push_back(static_cast<char>(it->first));
+                request.push_back(static_cast<char>(dir));
+                peers[0]->send(request);
+                words++;
+
+                for (size_t i = 0; i < peers.size(); i++)
+                {
+                    int cells = 0;
+                    while (cells < puzzle.word(id).length)
+                    {
+                        int type;
+                        std::vector<char> payload;
+                        bytes += read_frame(peers[i], type, payload);
+                        frames++;
+                        if (type == UPDATE_TYPE || type == UPDATE_BATCH_TYPE)
+                            cells += payload.size() / 3;
+                    }
+                }
+            }
+        }
+        double elapsed = now_usec() - start;
+
+        for (size_t i = 0; i < peers.size(); i++)
+            delete peers[i];
+        serv.stop();
+        server.join();
+
+        double per_peer = static_cast<double>(words) * peers.size();
+        std::cout << (protocol == 2 ? "update per letter  " : "update batches     ")
+            << std::setw(6) << frames / per_peer << " frames  "
+            << std::setw(6) << bytes / per_peer << " bytes per peer per word  "
+            << std::setw(8) << elapsed / words << " us per word\n";
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Cursor traffic, immediate against ticked
+// -----------------------------------------------------------------------------
+static void bench_cursors_run(puzzle_library& puzzles, const crossword_board& puzzle,
+        int npeers, int tick, int protocol, double seconds)
+{
+    crossword_server serv(puzzles, BENCH_PORT, send_limits());
+    serv.set_cursor_tick(tick);
+    std::thread server(&crossword_server::run, &serv);
+    clockid_t server_clock;
+    pthread_getcpuclockid(server.native_handle(), &server_clock);
+
+    std::vector<kissnet::tcp_socket*> peers;
+    for (int attempt = 0; peers.empty(); attempt++)
+    {
+        try
+        {
+            peers.push_back(join("", protocol));
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    for (int i = 1; i < npeers; i++)
+        peers.push_back(join("", protocol));
+
+    std::vector<frame_reader*> readers;
+    for (int i = 0; i < npeers; i++)
+    {
+        peers[i]->set_nonblocking(true);
+        readers.push_back(new frame_reader());
+    }
+
+    // Every peer holds down an arrow key, a move per peer per millisecond
+    struct timespec cpu;
+    clock_gettime(server_clock, &cpu);
+    double cpu_start = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3;
+    double start = now_usec();
+    long moves = 0, frames = 0, bytes = 0;
+    for (int round = 0; now_usec() - start < seconds * 1e6; round++)
+    {
+        for (int i = 0; i < npeers; i++)
+        {
+            std::string move;
+            move.push_back(static_cast<char>(CURSOR_TYPE));
+            move.push_back(0);
+            move.push_back(3);
+            move.push_back(static_cast<char>(round % puzzle.xdim()));
+            move.push_back(static_cast<char>(i % puzzle.ydim()));
+            move.push_back(static_cast<char>(crossword_board::across_dir));
+            peers[i]->send(move);
+            moves++;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (int i = 0; i < npeers; i++)
+        {
+            int got, type, size;
+            const char *payload;
+            while ((got = readers[i]->fill(*peers[i])) > 0)
+            {
+                bytes += got;
+                while (readers[i]->next(type, payload, size))
+                    frames++;
+            }
+        }
+    }
+    double elapsed = now_usec() - start;
+    clock_gettime(server_clock, &cpu);
+    double cpu_used = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3 - cpu_start;
+
+    for (int i = 0; i < npeers; i++)
+    {
+        delete readers[i];
+        delete peers[i];
+    }
+    serv.stop();
+    server.join();
+
+    std::ostringstream mode;
+    if (tick == 0)
+        mode << "immediate";
+    else
+        mode << tick << "ms tick" << (protocol >= 4 ? " batched" : "");
+    std::cout << std::left << std::setw(18) << mode.str() << std::right
+        << std::setw(9) << moves * 1e6 / elapsed << " moves/s  "
+        << std::setw(9) << frames * 1e6 / elapsed << " frames/s  "
+        << std::setw(10) << bytes * 1e6 / elapsed << " bytes/s  server cpu "
+        << std::setw(5) << 100 * cpu_used / elapsed << "%\n";
+}
+
+static int bench_cursors(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "cursors needs a crossword file\n";
+        return -1;
+    }
+    int npeers = argc > 1 ? atoi(argv[1]) : 8;
+    int tick = argc > 2 ? atoi(argv[2]) : 33;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    std::cout << npeers << " peers in one room\n" << std::fixed << std::setprecision(0);
+    bench_cursors_run(puzzles, puzzle, npeers, 0, 3, 2);
+    bench_cursors_run(puzzles, puzzle, npeers, tick, 3, 2);
+    bench_cursors_run(puzzles, puzzle, npeers, tick, 4, 2);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Move journal throughput, snapshots and recovery
+// -----------------------------------------------------------------------------
+// Journals random correct letters in batches the size of a loop iteration
+static void journal_moves(move_journal& journal, const std::vector<crossword_room*>& rooms,
+        const std::vector<std::pair<int, int> >& cells, long moves)
+{
+    const int batch = 32;
+    std::string records;
+    for (long i = 0; i < moves; i++)
+    {
+        crossword_room *room = rooms[rand() % rooms.size()];
+        const std::pair<int, int>& cell = cells[rand() % cells.size()];
+        char update[3] = { static_cast<char>(cell.first), static_cast<char>(cell.second),
+            room->board().answer_at(cell.first, cell.second) };
+        room->board().set_at(cell.first, cell.second, update[2]);
+        move_journal::add_updates(records, room->journal_id(), std::string(update, 3));
+        if (room->start_timer())
+            move_journal::add_timer(records, *room);
+
+        if ((i + 1) % batch == 0 || i + 1 == moves)
+        {
+            journal.append(records);
+            records.clear();
+        }
+    }
+}
+
+// Recovers the journal at path and reports how long it took
+static double journal_recover(puzzle_library& puzzles, const std::string& path,
+        std::vector<crossword_room*>& rooms)
+{
+    move_journal journal(path);
+    std::map<std::string, crossword_room*> recovered;
+    double start = now_usec();
+    long records = journal.recover(puzzles, recovered);
+    double elapsed = now_usec() - start;
+
+    for (std::map<std::string, crossword_room*>::iterator it = recovered.begin();
+            it != recovered.end(); it++)
+        rooms.push_back(it->second);
+    std::cout << records << " records into " << rooms.size() << " rooms in "
+        << elapsed / 1e3 << " ms\n";
+    return elapsed;
+}
+
+static void delete_rooms(std::vector<crossword_room*>& rooms)
+{
+    for (size_t i = 0; i < rooms.size(); i++)
+        delete rooms[i];
+    rooms.clear();
+}
+
+static void remove_journal(const std::string& path)
+{
+    remove((path + ".snap").c_str());
+    for (int seq = 1; seq < 16; seq++)
+    {
+        std::ostringstream segment;
+        segment << path << '.' << seq;
+        remove(segment.str().c_str());
+    }
+}
+
+static int bench_journal(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "journal needs a crossword file\n";
+        return -1;
+    }
+    int nrooms = argc > 1 ? atoi(argv[1]) : 2000;
+    long moves = argc > 2 ? atol(argv[2]) : 1000000;
+    std::string path = argc > 3 ? argv[3] : "bench_journal";
+    // Moves after the snapshot, the tail recovery still has to replay
+    long tail = moves / 100;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    std::vector<std::pair<int, int> > open_cells;
+    for (int y = 0; y < puzzle.ydim(); y++)
+    {
+        for (int x = 0; x < puzzle.xdim(); x++)
+        {
+            if (puzzle.layout_at(x, y) != crossword_board::wall_char)
+                open_cells.push_back(std::make_pair(x, y));
+        }
+    }
+
+    remove_journal(path);
+    srand(1);
+    std::cout << nrooms << " rooms, " << moves << " moves, journal in " << path
+        << ".*\n" << std::fixed << std::setprecision(0);
+    {
+        move_journal journal(path);
+        std::vector<crossword_room*> rooms;
+        for (int i = 0; i < nrooms; i++)
+        {
+            std::ostringstream id;
+            id << "/room" << i;
+            rooms.push_back(new crossword_room(id.str(), puzzle));
+            rooms[i]->set_journal_id(journal.open_room(id.str()));
+        }
+
+        double start = now_usec();
+        journal_moves(journal, rooms, open_cells, moves);
+        double appended = now_usec() - start;
+        journal.sync();
+        double synced = now_usec() - start;
+
+        long bytes, syncs, snapshots;
+        journal.stats(bytes, syncs, snapshots);
+        std::cout << "append    " << std::setw(10) << moves * 1e6 / appended
+            << " moves/s  " << std::setw(10) << moves * 1e6 / synced
+            << " moves/s durable  " << bytes / 1024 << " KB in " << syncs
+            << " syncs, " << static_cast<double>(moves) / std::max(1L, syncs)
+            << " moves per sync\n";
+        delete_rooms(rooms);
+    }
+
+    std::vector<crossword_room*> rooms;
+    std::cout << "replay    ";
+    double full = journal_recover(puzzles, path, rooms);
+
+    // Snapshot with a bit of traffic on either side, the copy is the only
+    // part an event loop would wait for
+    double copy;
+    {
+        move_journal journal(path);
+        std::map<std::string, crossword_room*> unused;
+        journal.recover(puzzles, unused);
+        for (std::map<std::string, crossword_room*>::iterator it = unused.begin();
+                it != unused.end(); it++)
+            delete it->second;
+
+        int seen = 0;
+        journal.add_loop([]() {});
+        journal_moves(journal, rooms, open_cells, tail);
+        journal.request_snapshot();
+        while (!journal.snapshot_due(seen))
+            std::this_thread::yield();
+
+        double start = now_usec();
+        std::vector<move_journal::room_state> states;
+        for (size_t i = 0; i < rooms.size(); i++)
+            move_journal::save_room(states, *rooms[i]);
+        journal.add_snapshot(states);
+        copy = now_usec() - start;
+
+        long bytes, syncs, snapshots = 0;
+        while (snapshots == 0)
+        {
+            std::this_thread::yield();
+            journal.stats(bytes, syncs, snapshots);
+        }
+        double written = now_usec() - start;
+        std::cout << "snapshot  copied " << rooms.size() << " rooms in " << copy / 1e3
+            << " ms, written in " << written / 1e3 << " ms\n";
+
+        journal_moves(journal, rooms, open_cells, tail);
+        journal.sync();
+    }
+    delete_rooms(rooms);
+
+    std::cout << "recover   ";
+    double compact = journal_recover(puzzles, path, rooms);
+    std::cout << "snapshot plus a " << tail << " move tail recovers "
+        << std::setprecision(1) << full / compact << "x faster than the full replay\n";
+    delete_rooms(rooms);
+    remove_journal(path);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Replay at full speed, process_message and the fan out to spectators
+// -----------------------------------------------------------------------------
+// Records players filling in wrong letters and moving their cursors, so the
+// replay never ends in a win
+static void record_game(const std::string& path, const crossword_board& puzzle,
+        int nplayers, long messages)
+{
+    game_recorder recorder(path);
+    std::string records;
+    std::string request("\0\0\4", 3);
+    for (int i = 0; i < nplayers; i++)
+    {
+        recorder.new_player();
+        recorder.add(records, i, BOARD_REQUEST_TYPE, request.data(), request.size());
+    }
+
+    std::vector<std::pair<int, int> > open_cells;
+    for (int y = 0; y < puzzle.ydim(); y++)
+    {
+        for (int x = 0; x < puzzle.xdim(); x++)
+        {
+            if (puzzle.layout_at(x, y) != crossword_board::wall_char)
+                open_cells.push_back(std::make_pair(x, y));
+        }
+    }
+
+    srand(1);
+    for (long i = 0; i < messages; i += 2)
+    {
+        const std::pair<int, int>& cell = open_cells[rand() % open_cells.size()];
+        char data[3] = { static_cast<char>(cell.first), static_cast<char>(cell.second),
+            '?' };
+        recorder.add(records, i / 2 % nplayers, UPDATE_TYPE, data, 3);
+        data[2] = static_cast<char>(crossword_board::across_dir);
+        recorder.add(records, i / 2 % nplayers, CURSOR_TYPE, data, 3);
+    }
+    recorder.append(records);
+}
+
+static int bench_replay(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "replay needs a crossword file\n";
+        return -1;
+    }
+    int nspectators = argc > 1 ? atoi(argv[1]) : 8;
+    long messages = argc > 2 ? atol(argv[2]) : 200000;
+    std::string path = "bench_recording";
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    record_game(path, puzzle, 4, messages);
+    game_replay replay(path, 0);
+    std::remove(path.c_str());
+
+    // The replay starts once the last spectator is in
+    crossword_server serv(puzzles, BENCH_PORT, send_limits());
+    serv.set_replay(&replay, nspectators);
+    std::thread server(&crossword_server::run, &serv);
+    clockid_t server_clock;
+    pthread_getcpuclockid(server.native_handle(), &server_clock);
+
+    std::vector<kissnet::tcp_socket*> spectators;
+    for (int attempt = 0; spectators.empty(); attempt++)
+    {
+        try
+        {
+            spectators.push_back(join("", 4));
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    for (int i = 1; i < nspectators; i++)
+        spectators.push_back(join("", 4));
+
+    std::vector<frame_reader*> readers;
+    for (int i = 0; i < nspectators; i++)
+    {
+        spectators[i]->set_nonblocking(true);
+        readers.push_back(new frame_reader());
+    }
+
+    struct timespec cpu;
+    clock_gettime(server_clock, &cpu);
+    double cpu_start = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3;
+    double start = now_usec();
+    // Every spectator gets every replayed update and cursor
+    long expected = static_cast<long>(replay.size() - 4) * nspectators;
+    long frames = 0;
+    double last_frame = start;
+    while (frames < expected && now_usec() - last_frame < 1e6)
+    {
+        for (int i = 0; i < nspectators; i++)
+        {
+            int type, size;
+            const char *payload;
+            while (readers[i]->fill(*spectators[i]) > 0)
+            {
+                while (readers[i]->next(type, payload, size))
+                    frames++;
+                last_frame = now_usec();
+            }
+        }
+    }
+    double elapsed = now_usec() - start;
+    clock_gettime(server_clock, &cpu);
+    double cpu_used = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3 - cpu_start;
+
+    for (int i = 0; i < nspectators; i++)
+    {
+        delete readers[i];
+        delete spectators[i];
+    }
+    serv.stop();
+    server.join();
+
+    std::cout << replay.size() << " messages to " << nspectators << " spectators\n"
+        << std::fixed << std::setprecision(0)
+        << std::setw(9) << replay.size() * 1e6 / elapsed << " messages/s  "
+        << std::setw(9) << frames * 1e6 / elapsed << " frames/s  "
+        << std::setprecision(2) << cpu_used / replay.size() << " us server cpu per message\n";
+    if (frames < expected)
+    {
+        std::cout << "only " << frames << " of " << expected << " frames arrived\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// One player watched by many, as peers and as spectators
+// -----------------------------------------------------------------------------
+static bool bench_watchers_run(puzzle_library& puzzles, const crossword_board& puzzle,
+        int nwatchers, bool spectators, double seconds)
+{
+    crossword_server serv(puzzles, BENCH_PORT, send_limits());
+    std::thread server(&crossword_server::run, &serv);
+    clockid_t server_clock;
+    pthread_getcpuclockid(server.native_handle(), &server_clock);
+
+    kissnet::tcp_socket *player = 0;
+    for (int attempt = 0; !player; attempt++)
+    {
+        try
+        {
+            player = join("", 4);
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    std::vector<kissnet::tcp_socket*> watchers;
+    std::vector<frame_reader*> readers;
+    for (int i = 0; i < nwatchers; i++)
+    {
+        watchers.push_back(join("", 4, spectators ? SPECTATOR_FLAG : 0));
+        watchers[i]->set_nonblocking(true);
+        readers.push_back(new frame_reader());
+    }
+
+    // The player types a burst of wrong letters, then everyone reads them
+    const int burst = 64;
+    std::string updates;
+    for (int i = 0; i < burst; i++)
+    {
+        updates.push_back(static_cast<char>(UPDATE_TYPE));
+        updates.push_back(0);
+        updates.push_back(3);
+        updates.push_back(static_cast<char>(i % puzzle.xdim()));
+        updates.push_back(static_cast<char>(i / puzzle.xdim() % puzzle.ydim()));
+        updates.push_back('?');
+    }
+    std::vector<char> echoes(updates.size());
+
+    struct timespec cpu;
+    clock_gettime(server_clock, &cpu);
+    double cpu_start = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3;
+    double start = now_usec();
+    long sent = 0;
+    bool ok = true;
+    while (ok && now_usec() - start < seconds * 1e6)
+    {
+        player->send(updates);
+        recv_all(player, &echoes[0], echoes.size());
+        sent += burst;
+
+        long frames = 0, expected = static_cast<long>(burst) * nwatchers;
+        double deadline = now_usec() + 5e6;
+        while (frames < expected)
+        {
+            if (now_usec() > deadline)
+            {
+                std::cout << "only " << frames << " of " << expected << " frames arrived\n";
+                ok = false;
+                break;
+            }
+            for (int i = 0; i < nwatchers; i++)
+            {
+                int type, size;
+                const char *payload;
+                while (readers[i]->fill(*watchers[i]) > 0)
+                {
+                    while (readers[i]->next(type, payload, size))
+                        frames++;
+                }
+            }
+        }
+    }
+    double elapsed = now_usec() - start;
+    clock_gettime(server_clock, &cpu);
+    double cpu_used = cpu.tv_sec * 1e6 + cpu.tv_nsec / 1e3 - cpu_start;
+
+    for (int i = 0; i < nwatchers; i++)
+    {
+        delete readers[i];
+        delete watchers[i];
+    }
+    delete player;
+    serv.stop();
+    server.join();
+
+    std::cout << std::left << std::setw(12) << (spectators ? "spectators" : "peers")
+        << std::right << std::fixed << std::setprecision(0)
+        << std::setw(9) << sent * 1e6 / elapsed << " updates/s  "
+        << std::setw(10) << sent * nwatchers * 1e6 / elapsed << " frames/s  "
+        << std::setprecision(2) << std::setw(7) << cpu_used / sent
+        << " us server cpu per update\n";
+    return ok;
+}
+
+static int bench_watchers(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "watchers needs a crossword file\n";
+        return -1;
+    }
+    int nwatchers = argc > 1 ? atoi(argv[1]) : 1000;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    raise_fd_limit();
+    std::cout << "1 player watched by " << nwatchers << '\n';
+    bool ok = bench_watchers_run(puzzles, puzzle, nwatchers, false, 3);
+    ok = bench_watchers_run(puzzles, puzzle, nwatchers, true, 3) && ok;
+
+    return ok ? 0 : 1;
+}
+
+// -----------------------------------------------------------------------------
+// Allocations per broadcast
+// -----------------------------------------------------------------------------
+// Sends packet from the first peer then reads read_size bytes on every peer,
+// rounds times.  Returns the allocations per round.
+static double allocs_per_round(const std::vector<kissnet::tcp_socket*>& peers,
+        const std::string& packet, int read_size, int rounds)
+{
+    std::vector<char> buf(read_size);
+    long before = allocations.load();
+    for (int i = 0; i < rounds; i++)
+    {
+        peers[0]->send(packet);
+        for (size_t j = 0; j < peers.size(); j++)
+            recv_all(peers[j], &buf[0], read_size);
+    }
+    return static_cast<double>(allocations.load() - before) / rounds;
+}
+
+// Every peer moves its cursor, then everyone reads the tick's batch
+static double allocs_per_tick(const std::vector<kissnet::tcp_socket*>& peers, int rounds)
+{
+    std::string move;
+    move.push_back(static_cast<char>(CURSOR_TYPE));
+    move.push_back(0);
+    move.push_back(3);
+    move.append(3, 0);
+    int read_size = HEADER_SIZE + 3 * (peers.size() - 1);
+    std::vector<char> buf(read_size);
+
+    long before = allocations.load();
+    for (int i = 0; i < rounds; i++)
+    {
+        for (size_t j = 0; j < peers.size(); j++)
+            peers[j]->send(move);
+        for (size_t j = 0; j < peers.size(); j++)
+            recv_all(peers[j], &buf[0], read_size);
+    }
+    return static_cast<double>(allocations.load() - before) / rounds;
+}
+
+static int bench_allocs(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "allocs needs a crossword file\n";
+        return -1;
+    }
+    int npeers = argc > 1 ? atoi(argv[1]) : 64;
+    const int rounds = 2000;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+
+    for (int tick = 0; tick < 2; tick++)
+    {
+        crossword_server serv(puzzles, BENCH_PORT, send_limits());
+        // The tick is long enough for every peer's cursor to make it in
+        serv.set_cursor_tick(tick ? 20 : 0);
+        std::thread server(&crossword_server::run, &serv);
+
+        std::vector<kissnet::tcp_socket*> peers;
+        for (int attempt = 0; peers.empty(); attempt++)
+        {
+            try
+            {
+                peers.push_back(join("", 4));
+            }
+            catch (kissnet::socket_exception& e)
+            {
+                if (attempt == 100)
+                    throw;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        for (int i = 1; i < npeers; i++)
+            peers.push_back(join("", 4));
+
+        std::cout << std::fixed << std::setprecision(2);
+        if (!tick)
+        {
+            // Wrong letters so nobody wins
+            std::string update;
+            update.push_back(static_cast<char>(UPDATE_TYPE));
+            update.push_back(0);
+            update.push_back(3);
+            update.append("\0\0?", 3);
+            double per_update = allocs_per_round(peers, update, update.size(), rounds);
+
+            std::string batch;
+            batch.push_back(static_cast<char>(UPDATE_BATCH_TYPE));
+            batch.push_back(0);
+            batch.push_back(24);
+            for (int i = 0; i < 8; i++)
+            {
+                batch.push_back(static_cast<char>(i));
+                batch.push_back(0);
+                batch.push_back('?');
+            }
+            double per_batch = allocs_per_round(peers, batch, batch.size(), rounds);
+            std::cout << npeers << " peers, allocations per broadcast\n"
+                << "  update      " << std::setw(8) << per_update << '\n'
+                << "  batch       " << std::setw(8) << per_batch << '\n';
+        }
+        else
+        {
+            double per_tick = allocs_per_tick(peers, rounds / 20);
+            std::cout << "  cursor tick " << std::setw(8) << per_tick << '\n';
+        }
+
+        for (size_t i = 0; i < peers.size(); i++)
+            delete peers[i];
+        serv.stop();
+        server.join();
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Many peers typing, system calls and latency with and without TCP_NODELAY
+// -----------------------------------------------------------------------------
+static void bench_typing_run(puzzle_library& puzzles, const crossword_board& puzzle,
+        int npeers, int keys_per_sec, bool nodelay, double seconds)
+{
+    crossword_server serv(puzzles, BENCH_PORT, send_limits());
+    serv.set_nodelay(nodelay);
+    std::thread server(&crossword_server::run, &serv);
+
+    std::vector<kissnet::tcp_socket*> peers;
+    for (int attempt = 0; peers.empty(); attempt++)
+    {
+        try
+        {
+            peers.push_back(join("", 4));
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    for (int i = 1; i < npeers; i++)
+        peers.push_back(join("", 4));
+
+    // Every peer has a cell of its own, typed into over and over
+    std::vector<int> cells;
+    for (int y = 0; y < puzzle.ydim() && static_cast<int>(cells.size()) < npeers; y++)
+    {
+        for (int x = 0; x < puzzle.xdim() && static_cast<int>(cells.size()) < npeers; x++)
+        {
+            if (puzzle.layout_at(x, y) != crossword_board::wall_char)
+                cells.push_back(y << 8 | x);
+        }
+    }
+    std::vector<int> owner(1 << 16, -1);
+    std::vector<frame_reader*> readers;
+    for (int i = 0; i < npeers; i++)
+    {
+        peers[i]->set_nonblocking(true);
+        peers[i]->set_nodelay(true);
+        readers.push_back(new frame_reader());
+        owner[cells[i % cells.size()]] = i;
+    }
+
+    // Peers take turns pressing a key.  The peer after the typist watches for
+    // it, so a key has its latency taken once.
+    std::vector<double> sent(npeers, 0), latencies;
+    double interval = 1e6 / keys_per_sec;
+    unsigned long calls_before = serv.stats().send_calls.load();
+    unsigned long bytes_before = serv.stats().bytes_out.load();
+    double start = now_usec(), next_key = start;
+    long keys = 0;
+    while (now_usec() - start < seconds * 1e6)
+    {
+        if (now_usec() >= next_key)
+        {
+            int typist = keys % npeers;
+            int cell = cells[typist % cells.size()];
+            std::string update;
+            update.push_back(static_cast<char>(UPDATE_TYPE));
+            update.push_back(0);
+            update.push_back(3);
+            update.push_back(static_cast<char>(cell & 0xff));
+            update.push_back(static_cast<char>(cell >> 8));
+            // Never an answer, so nobody wins
+            update.push_back('?');
+            sent[typist] = now_usec();
+            peers[typist]->send(update);
+            keys++;
+            next_key += interval;
+        }
+
+        for (int i = 0; i < npeers; i++)
+        {
+            int type, size;
+            const char *payload;
+            while (readers[i]->fill(*peers[i]) > 0)
+            {
+                while (readers[i]->next(type, payload, size))
+                {
+                    if (type != UPDATE_TYPE && type != UPDATE_BATCH_TYPE)
+                        continue;
+                    for (int c = 0; c + 3 <= size; c += 3)
+                    {
+                        int typist = owner[static_cast<unsigned char>(payload[c + 1]) << 8
+                            | static_cast<unsigned char>(payload[c])];
+                        if (typist >= 0 && (typist + 1) % npeers == i && sent[typist] > 0)
+                        {
+                            latencies.push_back(now_usec() - sent[typist]);
+                            sent[typist] = 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    double elapsed = now_usec() - start;
+    unsigned long calls = serv.stats().send_calls.load() - calls_before;
+    unsigned long bytes = serv.stats().bytes_out.load() - bytes_before;
+
+    for (int i = 0; i < npeers; i++)
+    {
+        delete readers[i];
+        delete peers[i];
+    }
+    serv.stop();
+    server.join();
+
+    double p50 = percentile(latencies, 0.5), p99 = percentile(latencies, 0.99);
+    std::cout << (nodelay ? "nodelay  " : "nagle    ")
+        << std::setw(8) << keys * 1e6 / elapsed << " keys/s  "
+        << std::setw(8) << calls * 1e6 / elapsed << " sends/s  "
+        << std::setw(6) << (calls ? static_cast<double>(bytes) / calls : 0) << " bytes/send  "
+        << "latency p50 " << std::setw(6) << p50 << " us  p99 "
+        << std::setw(6) << p99 << " us\n";
+}
+
+static int bench_typing(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "typing needs a crossword file\n";
+        return -1;
+    }
+    int npeers = argc > 1 ? atoi(argv[1]) : 50;
+    // Each peer types about ten keys a second
+    int keys_per_sec = argc > 2 ? atoi(argv[2]) : npeers * 10;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+
+    std::cout << npeers << " peers typing in one room\n" << std::fixed << std::setprecision(0);
+    bench_typing_run(puzzles, puzzle, npeers, keys_per_sec, true, 3);
+    bench_typing_run(puzzles, puzzle, npeers, keys_per_sec, false, 3);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Rejoining a room with a patch instead of the whole board
+// -----------------------------------------------------------------------------
+// Joins with protocol 5 and reads frames up to the BOARD_PATCH.  With resync
+// set the request carries history and version.  Board frames are read into
+// board and patches applied to it, bytes counts everything read.
+static kissnet::tcp_socket *join_synced(bool resync, uint32_t& history, uint32_t& version,
+        crossword_board& board, long& bytes)
+{
+    kissnet::tcp_socket *sock = new kissnet::tcp_socket();
+    sock->connect("127.0.0.1", BENCH_PORT);
+
+    std::string payload;
+    payload.push_back('\0');
+    payload.push_back(static_cast<char>(crossword_board::binary_version));
+    payload.push_back(5);
+    if (resync)
+    {
+        payload.push_back(RESYNC_FLAG);
+        for (int shift = 24; shift >= 0; shift -= 8)
+            payload.push_back(static_cast<char>((history >> shift) & 0xff));
+        for (int shift = 24; shift >= 0; shift -= 8)
+            payload.push_back(static_cast<char>((version >> shift) & 0xff));
+    }
+    std::string request;
+    request.push_back(static_cast<char>(BOARD_REQUEST_TYPE));
+    request.push_back(static_cast<char>(payload.size() / 256));
+    request.push_back(static_cast<char>(payload.size() % 256));
+    request.append(payload);
+    sock->send(request);
+
+    bytes = 0;
+    for (;;)
+    {
+        int type;
+        std::vector<char> frame;
+        bytes += read_frame(sock, type, frame);
+        if (type == BINARY_BOARD_TYPE)
+            board.read_binary(&frame[0], frame.size());
+        else if (type == BOARD_PATCH_TYPE)
+        {
+            const unsigned char *p = reinterpret_cast<const unsigned char*>(&frame[0]);
+            history = static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+            version = static_cast<uint32_t>(p[4]) << 24 | p[5] << 16 | p[6] << 8 | p[7];
+            for (size_t i = 8; i + 3 <= frame.size(); i += 3)
+                board.set_at(static_cast<unsigned char>(frame[i]),
+                        static_cast<unsigned char>(frame[i + 1]), frame[i + 2]);
+            return sock;
+        }
+    }
+}
+
+static int bench_resync(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "resync needs a crossword file\n";
+        return -1;
+    }
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+    std::ifstream infile(argv[0]);
+    puzzle_library puzzles("");
+    puzzles.set_default(infile);
+    const crossword_board& puzzle = *puzzles.puzzle_for_room("");
+    std::vector<int> cells;
+    for (int y = 0; y < puzzle.ydim(); y++)
+    {
+        for (int x = 0; x < puzzle.xdim(); x++)
+        {
+            if (puzzle.layout_at(x, y) != crossword_board::wall_char)
+                cells.push_back(y << 8 | x);
+        }
+    }
+
+    crossword_server serv(puzzles, BENCH_PORT, send_limits());
+    std::thread server(&crossword_server::run, &serv);
+    kissnet::tcp_socket *typist = 0;
+    for (int attempt = 0; !typist; attempt++)
+    {
+        try
+        {
+            typist = join("", 4);
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            if (attempt == 100)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    // A player drops, misses some keys and comes back, once asking for a
+    // patch and once for the whole board.  Both must end up with the same
+    // letters.
+    std::cout << std::fixed << std::setprecision(1);
+    int missed_counts[] = { 1, 10, 100, 1000 };
+    for (size_t m = 0; m < sizeof(missed_counts) / sizeof(missed_counts[0]); m++)
+    {
+        int missed = missed_counts[m];
+        long resync_bytes = 0, full_bytes = 0, patched = 0;
+        double resync_us = 0, full_us = 0;
+        bool same = true;
+        for (int r = 0; r < rounds; r++)
+        {
+            uint32_t history = 0, version = 0;
+            crossword_board board;
+            long bytes;
+            delete join_synced(false, history, version, board, bytes);
+
+            std::string updates;
+            for (int i = 0; i < missed; i++)
+            {
+                int cell = cells[(r * 7 + i) % cells.size()];
+                updates.push_back(static_cast<char>(UPDATE_TYPE));
+                updates.push_back(0);
+                updates.push_back(3);
+                updates.push_back(static_cast<char>(cell & 0xff));
+                updates.push_back(static_cast<char>(cell >> 8));
+                // Never an answer, so nobody wins
+                updates.push_back("?q"[(r + i) % 2]);
+            }
+            typist->send(updates);
+            std::vector<char> echoes(updates.size());
+            recv_all(typist, &echoes[0], echoes.size());
+
+            double start = now_usec();
+            delete join_synced(true, history, version, board, bytes);
+            resync_us += now_usec() - start;
+            resync_bytes += bytes;
+            long resync_round = bytes;
+
+            crossword_board full;
+            start = now_usec();
+            delete join_synced(false, history, version, full, bytes);
+            full_us += now_usec() - start;
+            full_bytes += bytes;
+            patched += resync_round < bytes;
+
+            std::string ours, theirs;
+            board.snapshot_letters(ours, true);
+            full.snapshot_letters(theirs, true);
+            same = same && ours == theirs;
+        }
+
+        std::cout << std::setw(5) << missed << " missed  resync "
+            << std::setw(8) << static_cast<double>(resync_bytes) / rounds << " bytes "
+            << std::setw(7) << resync_us / rounds << " us  full board "
+            << std::setw(8) << static_cast<double>(full_bytes) / rounds << " bytes "
+            << std::setw(7) << full_us / rounds << " us  "
+            << patched << "/" << rounds << " patched  "
+            << (same ? "boards match" : "BOARDS DIFFER") << '\n';
+    }
+
+    delete typist;
+    serv.stop();
+    server.join();
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Loading a directory of puzzles
+// -----------------------------------------------------------------------------
+// Loads every file, streamed or mapped, and reports how long it took.  Runs
+// in a child of its own so the peak RSS is only this loader's.
+static void bench_load_run(const std::vector<std::string>& paths, bool mapped,
+        const char *label)
+{
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cout << "fork failed\n";
+        return;
+    }
+    if (pid > 0)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    std::vector<crossword_board*> boards;
+    boards.reserve(paths.size());
+    long before_rss = peak_rss(), before_allocs = allocations.load(), failed = 0;
+    double start = now_usec();
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        crossword_board *board = new crossword_board();
+        try
+        {
+            if (mapped)
+            {
+                if (!board->read_file(paths[i]))
+                    failed++;
+            }
+            else
+            {
+                std::ifstream in(paths[i].c_str());
+                board->read(in);
+            }
+        }
+        catch (std::runtime_error& e)
+        {
+            failed++;
+        }
+        boards.push_back(board);
+    }
+    double elapsed = now_usec() - start;
+    long allocs = allocations.load() - before_allocs;
+
+    std::cout << label << paths.size() << " puzzles in "
+        << std::setw(7) << elapsed / 1e3 << " ms  " << std::setw(6)
+        << elapsed / paths.size() << " us each  " << std::setw(7)
+        << static_cast<double>(allocs) / paths.size() << " allocs each  peak RSS "
+        << std::setw(6) << peak_rss() / (1024 * 1024.0) << " MB (+"
+        << (peak_rss() - before_rss) / (1024 * 1024.0) << " MB)";
+    if (failed)
+        std::cout << "  " << failed << " failed";
+    std::cout << std::endl;
+    _exit(0);
+}
+
+static int bench_load(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        std::cout << "load needs a crossword file or a directory of them\n";
+        return -1;
+    }
+    int count = argc > 1 ? atoi(argv[1]) : 5000;
+
+    // A directory is loaded as it is, a single puzzle is copied count times
+    // into a scratch directory first
+    std::string dir = argv[0];
+    bool scratch = false;
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0)
+    {
+        std::cout << "can't find " << dir << '\n';
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        std::ifstream infile(argv[0]);
+        std::stringstream xml;
+        xml << infile.rdbuf();
+
+        char name[] = "/tmp/bench_puzzlesXXXXXX";
+        if (!mkdtemp(name))
+        {
+            std::cout << "can't make a scratch directory\n";
+            return -1;
+        }
+        dir = name;
+        scratch = true;
+        for (int i = 0; i < count; i++)
+        {
+            std::ostringstream path;
+            path << dir << "/puzzle" << i << ".xml";
+            std::ofstream out(path.str().c_str());
+            out << xml.str();
+        }
+    }
+
+    std::vector<std::string> paths;
+    DIR *d = opendir(dir.c_str());
+    while (struct dirent *entry = d ? readdir(d) : 0)
+    {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".xml") == 0)
+            paths.push_back(dir + "/" + name);
+    }
+    if (d)
+        closedir(d);
+    std::sort(paths.begin(), paths.end());
+    if (paths.empty())
+    {
+        std::cout << "no puzzles in " << dir << '\n';
+        return -1;
+    }
+
+    // The first pass only warms the page cache
+    std::cout << std::fixed << std::setprecision(1);
+    bench_load_run(paths, false, "warm up  ");
+    bench_load_run(paths, false, "stream   ");
+    bench_load_run(paths, true, "mmap     ");
+
+    if (scratch)
+    {
+        for (size_t i = 0; i < paths.size(); i++)
+            remove(paths[i].c_str());
+        rmdir(dir.c_str());
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " net [connections...]\n"
+            "       " << argv[0] << " rooms crossword_file [count]\n"
+            "       " << argv[0] << " won [size...]\n"
+            "       " << argv[0] << " cells [size...]\n"
+            "       " << argv[0] << " progress [size...]\n"
+            "       " << argv[0] << " board [crossword_file] [rounds]\n"
+            "       " << argv[0] << " joins crossword_file [joins]\n"
+            "       " << argv[0] << " shards crossword_file [max_loops] [rooms]\n"
+            "       " << argv[0] << " solve crossword_file [peers]\n"
+            "       " << argv[0] << " cursors crossword_file [peers] [tick_ms]\n"
+            "       " << argv[0] << " journal crossword_file [rooms] [moves] [path]\n"
+            "       " << argv[0] << " replay crossword_file [spectators] [messages]\n"
+            "       " << argv[0] << " watchers crossword_file [watchers]\n"
+            "       " << argv[0] << " allocs crossword_file [peers]\n"
+            "       " << argv[0] << " typing crossword_file [peers] [keys_per_sec]\n"
+            "       " << argv[0] << " resync crossword_file [rounds]\n"
+            "       " << argv[0] << " load crossword_file|puzzle_dir [count]\n";
+        return -1;
+    }
+
+    kissnet::init_networking();
+
+    std::string which = argv[1];
+    if (which == "net")
+        return bench_net(argc - 2, argv + 2);
+    if (which == "rooms")
+        return bench_rooms(argc - 2, argv + 2);
+    if (which == "won")
+        return bench_won(argc - 2, argv + 2);
+    if (which == "cells")
+        return bench_cells(argc - 2, argv + 2);
+    if (which == "progress")
+        return bench_progress(argc - 2, argv + 2);
+    if (which == "board")
+        return bench_board(argc - 2, argv + 2);
+    if (which == "joins")
+        return bench_joins(argc - 2, argv + 2);
+    if (which == "shards")
+        return bench_shards(argc - 2, argv + 2);
+    if (which == "solve")
+        return bench_solve(argc - 2, argv + 2);
+    if (which == "cursors")
+        return bench_cursors(argc - 2, argv + 2);
+    if (which == "journal")
+        return bench_journal(argc - 2, argv + 2);
+    if (which == "replay")
+        return bench_replay(argc - 2, argv + 2);
+    if (which == "watchers")
+        return bench_watchers(argc - 2, argv + 2);
+    if (which == "allocs")
+        return bench_allocs(argc - 2, argv + 2);
+    if (which == "typing")
+        return bench_typing(argc - 2, argv + 2);
+    if (which == "resync")
+        return bench_resync(argc - 2, argv + 2);
+    if (which == "load")
+        return bench_load(argc - 2, argv + 2);
+
+    std::cout << "unknown benchmark " << which << '\n';
+    return -1;
+}
@@ -6,9 +6,11 @@ connect_dialog::connect_dialog(const wxString& title)
 {
     hostname_ = new wxTextCtrl(this, wxID_ANY, wxT("127.0.0.1"));
     port_ = new wxTextCtrl(this, wxID_ANY, wxT("3333"));
+    room_ = new wxTextCtrl(this, wxID_ANY, wxT(""));
 
     wxStaticText *host_text = new wxStaticText(this, wxID_ANY, wxT("Address: "));
     wxStaticText *port_text = new wxStaticText(this, wxID_ANY, wxT("Port: "));
+    wxStaticText *room_text = new wxStaticText(this, wxID_ANY, wxT("Room: "));
 
     wxButton *ok_button = new wxButton(this, wxID_OK, wxT("&Ok"));
     wxButton *cancel_button = new wxButton(this, wxID_CANCEL, wxT("&Cancel"));
@@ -23,8 +25,13 @@ connect_dialog::connect_dialog(const wxString& title)
     info_sizer->Add(port_text,0, wxLEFT, 20);
     info_sizer->Add(port_);
 
+    wxBoxSizer *room_sizer = new wxBoxSizer(wxHORIZONTAL);
+    room_sizer->Add(room_text);
+    room_sizer->Add(room_, 1);
+
     wxBoxSizer *everything_sizer = new wxBoxSizer(wxVERTICAL);
     everything_sizer->Add(info_sizer, 1, wxTOP | wxRIGHT | wxLEFT, 20);
+    everything_sizer->Add(room_sizer, 0, wxEXPAND | wxTOP | wxRIGHT | wxLEFT, 20);
     everything_sizer->Add(button_sizer, 0, wxALIGN_RIGHT | wxTOP | wxBOTTOM | wxRIGHT | wxLEFT, 20);
 
     SetSizer(everything_sizer);
@@ -42,3 +49,8 @@ wxIPV4address connect_dialog::address() const
 
     return addr;
 }
+
+std::string connect_dialog::room() const
+{
+    return std::string(room_->GetLineText(0).mb_str(wxConvUTF8));
+}
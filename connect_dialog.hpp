@@ -1,6 +1,7 @@
 #pragma once
 #include <wx/wx.h>
 #include <wx/socket.h>
+#include <string>
 
 class connect_dialog : public wxDialog
 {
@@ -8,8 +9,11 @@ public:
     connect_dialog(const wxString& title = wxT("Connect to server"));
 
     wxIPV4address address() const;
+    // The room to join, empty for the server's default room
+    std::string room() const;
 
 private:
     wxTextCtrl* hostname_;
     wxTextCtrl* port_;
+    wxTextCtrl* room_;
 };
@@ -3,6 +3,29 @@
 #include <cassert>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <fstream>
+#include <iterator>
+#include <climits>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(_MSC_VER)) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define BOARD_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 // ----------------- Crossword Clue --------------------------------
 
@@ -10,15 +33,19 @@
  * Creates an empty clue.
  */
 crossword_clue::crossword_clue()
-: num_(-1), text_(), x_(-1), y_(-1)
+: num_(-1), pool_(0), offset_(0), length_(0), x_(-1), y_(-1)
 {
 }
 
 /**
  * Constructor
+ * @param pool The string holding the text, which must outlive the clue.
+ * @param offset Where the text starts in pool.
+ * @param text_length The length of the text, pool has a NUL after it.
  */
-crossword_clue::crossword_clue(int num, const std::string& text, int x, int y)
-: num_(num), text_(text), x_(x), y_(y)
+crossword_clue::crossword_clue(int num, const std::string *pool, size_t offset,
+        size_t text_length, int x, int y)
+: num_(num), pool_(pool), offset_(offset), length_(text_length), x_(x), y_(y)
 {
 }
 
@@ -33,11 +60,19 @@ int crossword_clue::number() const
 
 /**
  * Accessor for the clue text.
- * @return The text of the clue.
+ * @return The NUL terminated text of the clue.
  */
-const std::string& crossword_clue::text() const
+const char *crossword_clue::text() const
 {
-    return text_;
+    return pool_ ? pool_->data() + offset_ : "";
+}
+
+/**
+ * Accessor for the length of the clue text.
+ */
+size_t crossword_clue::text_length() const
+{
+    return length_;
 }
 
 /**
@@ -63,7 +98,8 @@ int crossword_clue::y() const
  */
 bool crossword_clue::operator==(const crossword_clue& rhs) const
 {
-    return rhs.num_ == num_ && rhs.text_ == text_ &&
+    return rhs.num_ == num_ && rhs.length_ == length_ &&
+        memcmp(rhs.text(), text(), length_) == 0 &&
         rhs.x_ == x_ && rhs.y_ == y_;
 }
 
@@ -91,6 +127,113 @@ std::ostream& operator<<(std::ostream& os, const crossword_clue& clue)
     return os;
 }
 
+// ------------------ Clue Set -------------------------------------
+
+clue_set::clue_set()
+: clues_(), positions_(), next_(), previous_()
+{
+}
+
+clue_set::const_iterator clue_set::begin() const
+{
+    return clues_.begin();
+}
+
+clue_set::const_iterator clue_set::end() const
+{
+    return clues_.end();
+}
+
+size_t clue_set::size() const
+{
+    return clues_.size();
+}
+
+bool clue_set::empty() const
+{
+    return clues_.empty();
+}
+
+/**
+ * Finds a clue by number.
+ * @return The clue or NULL if there isn't one with that number.
+ */
+const crossword_clue *clue_set::find(int num) const
+{
+    if (num < 0 || num >= static_cast<int>(positions_.size()) || positions_[num] < 0)
+        return 0;
+    return &clues_[positions_[num]].second;
+}
+
+/**
+ * The clue with the lowest number above num, or the first clue if there is
+ * none above it.
+ */
+const crossword_clue *clue_set::next(int num) const
+{
+    if (clues_.empty())
+        return 0;
+    if (num < 0 || num >= static_cast<int>(next_.size()))
+        return &clues_.front().second;
+    return &clues_[next_[num]].second;
+}
+
+/**
+ * The clue with the highest number below num, or the last clue if there is
+ * none below it.
+ */
+const crossword_clue *clue_set::previous(int num) const
+{
+    if (clues_.empty())
+        return 0;
+    if (num < 0 || num >= static_cast<int>(previous_.size()))
+        return num < 0 ? &clues_.back().second : &clues_[previous_.back()].second;
+    return &clues_[previous_[num]].second;
+}
+
+void clue_set::add(const crossword_clue& clue)
+{
+    clues_.push_back(value_type(clue.number(), clue));
+}
+
+/**
+ * Sorts the clues by number, drops replaced ones and builds the lookup
+ * tables.
+ */
+void clue_set::index()
+{
+    // Stable, so of two clues with one number the one added last is last
+    std::stable_sort(clues_.begin(), clues_.end(),
+            [](const value_type& a, const value_type& b) { return a.first < b.first; });
+    std::vector<value_type> unique;
+    for (size_t i = 0; i < clues_.size(); i++)
+    {
+        if (i + 1 < clues_.size() && clues_[i + 1].first == clues_[i].first)
+            continue;
+        unique.push_back(clues_[i]);
+    }
+    clues_.swap(unique);
+
+    // One past the highest number so previous of it is the last clue
+    int highest = clues_.empty() ? -1 : clues_.back().first;
+    positions_.assign(highest + 1, -1);
+    next_.assign(highest + 2, 0);
+    previous_.assign(highest + 2, 0);
+    for (size_t i = 0; i < clues_.size(); i++)
+        positions_[clues_[i].first] = i;
+
+    int last = clues_.size() - 1;
+    for (int num = 0, pos = 0; num <= highest + 1; num++)
+    {
+        // pos is the first clue numbered num or above
+        while (pos <= last && clues_[pos].first < num)
+            pos++;
+        previous_[num] = pos == 0 ? last : pos - 1;
+        int after = pos <= last && clues_[pos].first == num ? pos + 1 : pos;
+        next_[num] = after > last ? 0 : after;
+    }
+}
+
 // ------------------ Crossword Board ------------------------------
 
 /// Constant representing the across direction for clues
@@ -99,6 +242,14 @@ const int crossword_board::across_dir = 1;
 const int crossword_board::down_dir   = 2;
 /// Constant representing a wall in the layout array
 const int crossword_board::wall_char = -1;
+/// The most a clue_number holds
+const int crossword_board::max_clue = INT16_MAX;
+/// The longest clue text a board can have
+const size_t crossword_board::max_clue_text = UINT16_MAX;
+/// Changes a board keeps, a few minutes of a busy game
+const int crossword_board::history_size = 512;
+/// Version of the binary format, bumped whenever the layout changes
+const int crossword_board::binary_version = 2;
 
 /**
  * Default constructor.
@@ -107,10 +258,12 @@ const int crossword_board::wall_char = -1;
  */
 crossword_board::crossword_board()
 : xdim_(0), ydim_(0),
-    across_(), down_(),
+    puzzle_(),
     letters_(0), layout_(0), answers_(0),
-    initialized_(false)
+    wrong_(0), initialized_(false),
+    history_id_(0), version_(0), history_(), history_start_(0)
 {
+    start_history();
 }
 
 /// Destructor
@@ -119,6 +272,94 @@ crossword_board::~crossword_board()
     clear_data();
 }
 
+/**
+ * Copy constructor.  The new board shares the puzzle data with other and gets
+ * its own copy of the letters.
+ */
+crossword_board::crossword_board(const crossword_board& other)
+: xdim_(0), ydim_(0),
+    puzzle_(),
+    letters_(0), layout_(0), answers_(0),
+    wrong_(0), initialized_(false),
+    history_id_(0), version_(0), history_(), history_start_(0)
+{
+    *this = other;
+}
+
+/**
+ * Assignment operator.  Shares the puzzle data with rhs and copies its
+ * letters.
+ */
+crossword_board& crossword_board::operator=(const crossword_board& rhs)
+{
+    if (this == &rhs)
+        return *this;
+
+    clear_data();
+
+    xdim_ = rhs.xdim_;
+    ydim_ = rhs.ydim_;
+    puzzle_ = rhs.puzzle_;
+    if (puzzle_)
+    {
+        layout_ = puzzle_->layout;
+        answers_ = puzzle_->answers;
+    }
+    if (rhs.letters_)
+    {
+        letters_ = new char[xdim_ * ydim_];
+        std::copy(rhs.letters_, rhs.letters_ + xdim_ * ydim_, letters_);
+    }
+    wrong_ = rhs.wrong_;
+    initialized_ = rhs.initialized_;
+
+    return *this;
+}
+
+/**
+ * Move constructor.  Takes other's puzzle and letters without copying
+ * anything and leaves other empty.
+ */
+crossword_board::crossword_board(crossword_board&& other) noexcept
+: xdim_(0), ydim_(0),
+    puzzle_(),
+    letters_(0), layout_(0), answers_(0),
+    wrong_(0), initialized_(false),
+    history_id_(0), version_(0), history_(), history_start_(0)
+{
+    *this = std::move(other);
+}
+
+/**
+ * Move assignment.  Frees this board's letters, takes rhs's puzzle and
+ * letters and leaves rhs empty.
+ */
+crossword_board& crossword_board::operator=(crossword_board&& rhs) noexcept
+{
+    if (this == &rhs)
+        return *this;
+
+    clear_data();
+
+    xdim_ = rhs.xdim_;
+    ydim_ = rhs.ydim_;
+    puzzle_ = std::move(rhs.puzzle_);
+    letters_ = rhs.letters_;
+    layout_ = rhs.layout_;
+    answers_ = rhs.answers_;
+    wrong_ = rhs.wrong_;
+    initialized_ = rhs.initialized_;
+    history_id_ = rhs.history_id_;
+    version_ = rhs.version_;
+    history_.swap(rhs.history_);
+    history_start_ = rhs.history_start_;
+
+    rhs.letters_ = 0;
+    rhs.clear_data();
+
+    return *this;
+}
+
 /**
  * Flag indicating whether or not this crossword_board object is ready to use.
  * @return True if the board is usable.
@@ -135,14 +376,7 @@ bool crossword_board::initialized() const
  */
 bool crossword_board::won() const
 {
-    for (int i = 0; i < xdim_ * ydim_; i++)
-    {
-        if (letters_[i] != answers_[i] && (isalpha(answers_[i]) ||
-                answers_[i] == ' '))
-            return false;
-    }
-
-    return true;
+    return wrong_ == 0;
 }
 
 /**
@@ -174,22 +408,11 @@ int crossword_board::ydim() const
 const crossword_clue& crossword_board::clue(int dir, int num) const
 {
     assert(dir == down_dir || dir == across_dir); 
-    if (dir == across_dir)
-    {
-        clue_set::const_iterator it = across_.find(num);
-        if (it != across_.end())
-            return it->second;
-    }
-    else if (dir == down_dir)
-    {
-        clue_set::const_iterator it = down_.find(num);
-        if (it != down_.end())
-            return it->second;
-    }
-    else
+    if (dir != across_dir && dir != down_dir)
         throw std::invalid_argument("Invalid direction parameter");
 
-    return crossword_clue::empty_clue;
+    const crossword_clue *clue = clues(dir).find(num);
+    return clue ? *clue : crossword_clue::empty_clue;
 }
 
 /**
@@ -204,15 +427,22 @@ const crossword_clue& crossword_board::next_clue(int dir, int num) const
 {
     assert(dir == down_dir || dir == across_dir);
 
-    const clue_set& set = (dir == down_dir) ? down_ : across_;
-    clue_set::const_iterator clue_it = set.upper_bound(num);
-    if (clue_it == set.end())
-        clue_it = set.lower_bound(0);
-    
-    if (clue_it != set.end())
-        return clue_it->second;
+    const crossword_clue *clue = clues(dir).next(num);
+    return clue ? *clue : crossword_clue::empty_clue;
+}
+
+/**
+ * The clue before a number in a direction, wrapping around like next_clue.
+ * @param dir The direction.
+ * @param num The number after the clue to be found.
+ * @return The previous clue.
+ */
+const crossword_clue& crossword_board::previous_clue(int dir, int num) const
+{
+    assert(dir == down_dir || dir == across_dir);
 
-    return crossword_clue::empty_clue;
+    const crossword_clue *clue = clues(dir).previous(num);
+    return clue ? *clue : crossword_clue::empty_clue;
 }
 
 /**
@@ -224,9 +454,14 @@ const clue_set& crossword_board::clues(int dir) const
 {
     assert(dir == down_dir || dir == across_dir);
 
+    // A board without a puzzle has no clues
+    static const clue_set no_clues;
+    if (!puzzle_)
+        return no_clues;
+
     if (dir == across_dir)
-        return across_; else if (dir == down_dir)
-        return down_;
+        return puzzle_->across; else if (dir == down_dir)
+        return puzzle_->down;
 
     throw std::invalid_argument("Invalid direction parameter");
 }
@@ -274,16 +509,74 @@ char crossword_board::at(int x, int y) const
 }
 
 /**
- * Mutator for the letters data. Returns a non const reference.
+ * Mutator for the letters data.  Keeps the count of wrong cells used by won
+ * up to date.
  * @param x The x coord [0..xdim-1]
  * @param y The y coord [0..ydim-1]
- * @return The current character at the given position.
+ * @param ch The new character at the given position.
  */
-char& crossword_board::at(int x, int y)
+void crossword_board::set_at(int x, int y, char ch)
 {
     assert( x < xdim_ && x >= 0 );
     assert( y < ydim_ && y >= 0 );
-    return letters_[y * xdim_ + x];
+    int i = y * xdim_ + x;
+    if (required(i))
+        wrong_ += (ch != answers_[i]) - (letters_[i] != answers_[i]);
+    letters_[i] = ch;
+
+    version_++;
+    cell_change change = { i, ch };
+    if (history_.size() < static_cast<size_t>(history_size))
+        history_.push_back(change);
+    else
+    {
+        history_[history_start_] = change;
+        history_start_ = (history_start_ + 1) % history_.size();
+    }
+}
+
+uint32_t crossword_board::history_id() const
+{
+    return history_id_;
+}
+
+uint32_t crossword_board::version() const
+{
+    return version_;
+}
+
+/**
+ * Collects what changed since a version, for bringing a copy of the board
+ * that is at that version up to date.
+ * @param version A version of this board's current history.
+ * @param cells The string to append x, y, letter triples to.
+ * @return False if a full snapshot is needed instead.
+ */
+bool crossword_board::changes_since(uint32_t version, std::string& cells) const
+{
+    if (version > version_ || version_ - version > history_.size() ||
+            xdim_ > 256 || ydim_ > 256)
+        return false;
+
+    // Newest first, so only the latest letter of each cell is picked
+    size_t count = version_ - version;
+    std::set<int> seen;
+    std::vector<const cell_change*> latest;
+    for (size_t k = 0; k < count; k++)
+    {
+        const cell_change& change =
+            history_[(history_start_ + history_.size() - 1 - k) % history_.size()];
+        if (seen.insert(change.cell).second)
+            latest.push_back(&change);
+    }
+
+    for (size_t k = latest.size(); k-- > 0; )
+    {
+        cells.push_back(static_cast<char>(latest[k]->cell % xdim_));
+        cells.push_back(static_cast<char>(latest[k]->cell / xdim_));
+        cells.push_back(latest[k]->letter);
+    }
+    return true;
 }
 
 /*!
@@ -295,33 +588,164 @@ char& crossword_board::at(int x, int y)
  */
 void crossword_board::start_of_clue(int clue, int &x, int &y) const
 {
-    // Iterate over the layout array until we find the start
-    for (x = 0; x < xdim_; x++)
-    {
-        for (y = 0; y < ydim_; y++)
-        {
-            if (layout_[y * xdim_ + x] == clue)
-                return;
-        }
-    }
+    int id = word_of_clue(across_dir, clue);
+    if (id < 0)
+        id = word_of_clue(down_dir, clue);
+    assert(id >= 0 && "Unable to find clue");
 
-    assert(false && "Unable to find clue");
+    x = word(id).x;
+    y = word(id).y;
+}
+
+/**
+ * Finds the word running through a cell.
+ * @param x The x coord [0..xdim-1]
+ * @param y The y coord [0..ydim-1]
+ * @param dir across_dir or down_dir
+ * @return The word id or -1 for a wall.
+ */
+int crossword_board::word_at(int x, int y, int dir) const
+{
+    assert( x < xdim_ && x >= 0 );
+    assert( y < ydim_ && y >= 0 );
+    assert(dir == down_dir || dir == across_dir);
+
+    int *words = dir == across_dir ? puzzle_->across_words : puzzle_->down_words;
+    return words[y * xdim_ + x];
+}
+
+/**
+ * Finds the word a clue is for.
+ * @param dir across_dir or down_dir
+ * @param clue The clue number.
+ * @return The word id or -1 if no word in that direction has the number.
+ */
+int crossword_board::word_of_clue(int dir, int clue) const
+{
+    assert(dir == down_dir || dir == across_dir);
+    if (!puzzle_ || clue <= 0)
+        return -1;
+
+    const std::vector<int>& ids = dir == across_dir ? puzzle_->across_clues :
+        puzzle_->down_clues;
+    if (clue >= static_cast<int>(ids.size()))
+        return -1;
+    return ids[clue];
+}
+
+/**
+ * Accessor for a word's start, length, direction and clue number.
+ * @param id A word id from word_at or word_of_clue.
+ */
+const crossword_word& crossword_board::word(int id) const
+{
+    assert(id >= 0 && id < static_cast<int>(puzzle_->words.size()));
+    return puzzle_->words[id];
 }
 
 /**
  * Reads in all the board data from the given istream.  The expected format is
  * an XML based format of which an example is given in test.xml.
  * @param in The istream to read from.
- * @return True if success.
  */
 void crossword_board::read(std::istream& in)
 {
-    // Remove any old data
-    clear_data();
+    TiXmlDocument doc;
+    in >> doc;
+    read_document(doc);
+}
 
+#ifndef _MSC_VER
+/**
+ * A puzzle file mapped read only for the length of a read_file.  Only mapped
+ * if the file ends part way into a page, the rest of that page reads as
+ * zeros and terminates the text for TinyXML.
+ */
+class mapped_puzzle
+{
+public:
+    mapped_puzzle(int fd, size_t size)
+    : data_(MAP_FAILED), size_(size)
+    {
+        if (size_ == 0 || size_ % sysconf(_SC_PAGESIZE) == 0)
+            return;
+        data_ = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data_ != MAP_FAILED)
+            madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+
+    ~mapped_puzzle()
+    {
+        if (data_ != MAP_FAILED)
+            munmap(data_, size_);
+    }
 
+    // The NUL terminated text, NULL if the file isn't mapped
+    const char *text() const
+    {
+        return data_ != MAP_FAILED ? static_cast<const char*>(data_) : 0;
+    }
+
+private:
+    // Not copyable
+    mapped_puzzle(const mapped_puzzle&);
+    mapped_puzzle& operator=(const mapped_puzzle&);
+
+    void *data_;
+    size_t size_;
+};
+#endif
+
+/**
+ * Reads a puzzle file in the format read takes.  The file is memory mapped
+ * and TinyXML parses the mapped bytes, where a stream is first copied into a
+ * string a character at a time.  Files that can't be mapped are read whole
+ * into a string instead.
+ * @param path The puzzle file.
+ * @return False if the file can't be opened.  Errors in the puzzle are thrown.
+ */
+bool crossword_board::read_file(const std::string& path)
+{
     TiXmlDocument doc;
-    in >> doc;
+#ifndef _MSC_VER
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+    {
+        mapped_puzzle file(fd, st.st_size);
+        close(fd);
+        if (file.text())
+        {
+            doc.Parse(file.text(), 0, TIXML_DEFAULT_ENCODING);
+            read_document(doc);
+            return true;
+        }
+    }
+#endif
+
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+        return false;
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    doc.Parse(text.c_str(), 0, TIXML_DEFAULT_ENCODING);
+    read_document(doc);
+    return true;
+}
+
+/**
+ * Fills in the board from a parsed puzzle.
+ * @param doc The document read or read_file parsed.
+ */
+void crossword_board::read_document(TiXmlDocument& doc)
+{
+    // Remove any old data
+    clear_data();
 
     TiXmlElement *current = doc.FirstChildElement();
     if (!current)
@@ -336,13 +760,14 @@ void crossword_board::read(std::istream& in)
         if (tag == "Width")
         {
             current->Attribute("v", &xdim_);
-            if (xdim_ == 0)
+            // The binary format keeps both in a u16
+            if (xdim_ <= 0 || xdim_ > UINT16_MAX)
                 throw std::runtime_error("Error filling xdim");
         }
         else if (tag == "Height")
         {
             current->Attribute("v", &ydim_);
-            if (ydim_ == 0)
+            if (ydim_ <= 0 || ydim_ > UINT16_MAX)
                 throw std::runtime_error("Error filling ydim");
         }
         else if (tag == "AllAnswer")
@@ -350,7 +775,7 @@ void crossword_board::read(std::istream& in)
             std::string answer_str = current->Attribute("v");
             if (xdim_ == 0 && ydim_ == 0)
                 throw std::runtime_error("xdim and ydim values were not filled before AllAnswer element");
-            if (xdim_ * ydim_ != static_cast<int>(answer_str.length()))
+            if (static_cast<size_t>(xdim_) * ydim_ != answer_str.length())
                 throw std::runtime_error("The answer string is of the wrong length");
 
             allocate_memory();
@@ -363,15 +788,15 @@ void crossword_board::read(std::istream& in)
                     layout_[i] = wall_char;
             }
         }
-        else if (tag == "across")
-        {
-            TiXmlElement* clue_elem = current->FirstChildElement();
-            read_clues(clue_elem, across_);
-        }
-        else if (tag == "down")
+        else if (tag == "across" || tag == "down")
         {
+            if (!puzzle_)
+                throw std::runtime_error("Clues came before the AllAnswer element");
+
+            // write puts out an empty element when there are no clues
             TiXmlElement* clue_elem = current->FirstChildElement();
-            read_clues(clue_elem, down_);
+            if (clue_elem)
+                read_clues(clue_elem, tag == "across" ? puzzle_->across : puzzle_->down);
         }
         else if (tag == "letters")
         {
@@ -389,6 +814,10 @@ void crossword_board::read(std::istream& in)
         }
             
     } while ((current = current->NextSiblingElement()));
+
+    if (puzzle_)
+        index_words();
+    count_wrong();
 }
 
 // TODO move to a utilities header or something like that
@@ -430,11 +859,8 @@ void crossword_board::read_clues(TiXmlElement* clue_elem, clue_set& set)
         text = cur->Attribute("c");
 
         pos--;
-        int x = pos % xdim_;
-        int y = pos / xdim_;
         unescape(text);
-        set[num] = crossword_clue(num, text, x, y);
-        layout_[pos] = num;
+        add_clue(set, num, text.data(), text.size(), pos);
     } while ((cur = cur->NextSiblingElement()));
 }
 
@@ -466,11 +892,11 @@ void crossword_board::write(std::ostream& out, bool letters) const
     crossword->LinkEndChild(answers);
 
     TiXmlElement *across = new TiXmlElement("across");
-    write_clues(across, across_);
+    write_clues(across, clues(across_dir));
     crossword->LinkEndChild(across);
 
     TiXmlElement *down = new TiXmlElement("down");
-    write_clues(down, down_);
+    write_clues(down, clues(down_dir));
     crossword->LinkEndChild(down);
 
     if (letters)
@@ -496,7 +922,7 @@ void crossword_board::write_clues(TiXmlElement* parent, const clue_set& clues) c
     for (; it != clues.end(); it++)
     {
         TiXmlElement *clue_elem = new TiXmlElement("clue");
-        crossword_clue clue = it->second;
+        const crossword_clue& clue = it->second;
         clue_elem->SetAttribute("c", clue.text());
         clue_elem->SetAttribute("cn", clue.number());
         clue_elem->SetAttribute("n", clue.x() + clue.y() * xdim_ + 1);
@@ -504,6 +930,534 @@ void crossword_board::write_clues(TiXmlElement* parent, const clue_set& clues) c
     }
 }
 
+// -------------------------------------------------------------------
+// Binary format
+//
+// All integers are big endian.
+//   'X' 'W' version flags     flags bit 0 set if letters follow the answers
+//   u16 xdim, u16 ydim
+//   answers                   xdim * ydim bytes
+//   across clues, down clues  u16 count, then per clue
+//                             u16 number, u32 cell, u16 length, text
+//   letters                   xdim * ydim bytes
+// The letters come last so the rest can be encoded once per puzzle.
+// The layout is rebuilt from the walls in the answers and the clue cells,
+// the same way read does it.
+// -------------------------------------------------------------------
+
+static void put_u16(std::string& out, int val)
+{
+    out.push_back(static_cast<char>((val >> 8) & 0xff));
+    out.push_back(static_cast<char>(val & 0xff));
+}
+
+static void put_u32(std::string& out, int val)
+{
+    put_u16(out, (val >> 16) & 0xffff);
+    put_u16(out, val & 0xffff);
+}
+
+// Bounds checked reads from a binary board
+struct binary_reader
+{
+    const unsigned char *pos;
+    const unsigned char *end;
+
+    void need(size_t n) const
+    {
+        if (static_cast<size_t>(end - pos) < n)
+            throw std::runtime_error("The binary board is truncated");
+    }
+
+    int u8()
+    {
+        need(1);
+        return *pos++;
+    }
+
+    int u16()
+    {
+        need(2);
+        int val = pos[0] << 8 | pos[1];
+        pos += 2;
+        return val;
+    }
+
+    int u32()
+    {
+        need(4);
+        int val = static_cast<int>(static_cast<unsigned>(pos[0]) << 24 |
+                pos[1] << 16 | pos[2] << 8 | pos[3]);
+        pos += 4;
+        return val;
+    }
+
+    const char *bytes(size_t n)
+    {
+        need(n);
+        const char *ret = reinterpret_cast<const char*>(pos);
+        pos += n;
+        return ret;
+    }
+};
+
+/**
+ * Reads a board written by write_binary.  Grids are copied straight out of
+ * data, there is no intermediate document.
+ * @param data The encoded board.
+ * @param size The size of data in bytes.
+ */
+void crossword_board::read_binary(const char *data, size_t size)
+{
+    clear_data();
+
+    binary_reader in = { reinterpret_cast<const unsigned char*>(data),
+        reinterpret_cast<const unsigned char*>(data) + size };
+    if (in.u8() != 'X' || in.u8() != 'W')
+        throw std::runtime_error("Not a binary board");
+    if (in.u8() != binary_version)
+        throw std::runtime_error("Unsupported binary board version");
+    int flags = in.u8();
+
+    xdim_ = in.u16();
+    ydim_ = in.u16();
+    if (xdim_ == 0 || ydim_ == 0)
+        throw std::runtime_error("The binary board has no cells");
+    // Two u16s can multiply past an int, and the answers must be there
+    // before anything is allocated for them
+    if (static_cast<size_t>(xdim_) * ydim_ > INT_MAX)
+        throw std::runtime_error("The binary board is too big");
+    int cells = xdim_ * ydim_;
+    in.need(cells);
+
+    allocate_memory();
+    memcpy(answers_, in.bytes(cells), cells);
+    for (int i = 0; i < cells; i++)
+    {
+        if (answers_[i] == '-')
+            layout_[i] = wall_char;
+    }
+
+    for (int dir = across_dir; dir <= down_dir; dir++)
+    {
+        clue_set& set = dir == across_dir ? puzzle_->across : puzzle_->down;
+        int count = in.u16();
+        for (int i = 0; i < count; i++)
+        {
+            int num = in.u16();
+            int pos = in.u32();
+            int len = in.u16();
+            add_clue(set, num, in.bytes(len), len, pos);
+        }
+    }
+    if (flags & 1)
+        memcpy(letters_, in.bytes(cells), cells);
+
+    index_words();
+    count_wrong();
+}
+
+/**
+ * Serializes this board in the binary format, appending it to out.
+ * @param out The string to append to.
+ * @param letters If true will include the current letters.
+ */
+void crossword_board::write_binary(std::string& out, bool letters) const
+{
+    write_binary_puzzle(out, letters);
+    if (letters)
+        out.append(letters_, xdim_ * ydim_);
+}
+
+/**
+ * Writes everything in the binary format up to the letters.
+ * @param out The string to append to.
+ * @param letters Whether the header says letters follow.
+ */
+void crossword_board::write_binary_puzzle(std::string& out, bool letters) const
+{
+    int cells = xdim_ * ydim_;
+    out.reserve(out.size() + 8 + cells * 2);
+
+    out.push_back('X');
+    out.push_back('W');
+    out.push_back(static_cast<char>(binary_version));
+    out.push_back(letters ? 1 : 0);
+    put_u16(out, xdim_);
+    put_u16(out, ydim_);
+    out.append(answers_, cells);
+
+    for (int dir = across_dir; dir <= down_dir; dir++)
+    {
+        const clue_set& set = clues(dir);
+        put_u16(out, set.size());
+        for (clue_set::const_iterator it = set.begin(); it != set.end(); it++)
+        {
+            const crossword_clue& clue = it->second;
+            put_u16(out, clue.number());
+            put_u32(out, clue.y() * xdim_ + clue.x());
+            put_u16(out, clue.text_length());
+            out.append(clue.text(), clue.text_length());
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Snapshots
+// -------------------------------------------------------------------
+
+static std::atomic<long> snapshot_hits(0);
+static std::atomic<long> snapshot_misses(0);
+
+/**
+ * Encodes the whole board, letters included, for sending to a client.  The
+ * output is the same as write or write_binary but everything except the
+ * letters is encoded only once per puzzle and shared by every board playing
+ * it.  Safe to call on boards sharing a puzzle from different threads.
+ * @param out The string to append to.
+ * @param binary True for the binary format, false for XML.
+ */
+void crossword_board::write_snapshot(std::string& out, bool binary) const
+{
+    out.append(snapshot_puzzle(binary));
+    snapshot_letters(out, binary);
+}
+
+/**
+ * The first part of write_snapshot, encoded the first time it is asked for
+ * and kept with the puzzle.
+ * @param binary True for the binary format, false for XML.
+ * @return The encoded puzzle, valid as long as this board's puzzle.
+ */
+const std::string& crossword_board::snapshot_puzzle(bool binary) const
+{
+    static const std::string no_puzzle;
+    if (!puzzle_)
+        return no_puzzle;
+
+    puzzle_data& p = *puzzle_;
+    bool miss = false;
+    if (binary)
+    {
+        std::call_once(p.binary_once, [&]() {
+            write_binary_puzzle(p.binary_prefix, true);
+            miss = true;
+        });
+    }
+    else
+    {
+        std::call_once(p.xml_once, [&]() {
+            // Everything but the closing tag, the letters element goes there
+            std::ostringstream xml;
+            write(xml, false);
+            p.xml_prefix = xml.str();
+            p.xml_prefix.erase(p.xml_prefix.rfind("</crossword>"));
+            miss = true;
+        });
+    }
+
+    if (miss)
+        snapshot_misses++;
+    else
+        snapshot_hits++;
+
+    return binary ? p.binary_prefix : p.xml_prefix;
+}
+
+/**
+ * The rest of write_snapshot, the letters and whatever closes the document.
+ * @param out The string to append to.
+ * @param binary True for the binary format, false for XML.
+ */
+void crossword_board::snapshot_letters(std::string& out, bool binary) const
+{
+    if (!puzzle_)
+        return;
+
+    if (binary)
+    {
+        out.append(letters_, xdim_ * ydim_);
+        return;
+    }
+
+    std::string letters;
+    TiXmlBase::EncodeString(std::string(letters_, xdim_ * ydim_), &letters);
+    out.append("<letters v=\"");
+    out.append(letters);
+    out.append("\" /></crossword>");
+}
+
+/**
+ * Counts of write_snapshot calls that reused an encoded puzzle and that had
+ * to encode one, over every board in the process.
+ */
+void crossword_board::snapshot_stats(long& hits, long& misses)
+{
+    hits = snapshot_hits;
+    misses = snapshot_misses;
+}
+
+// -------------------------------------------------------------------
+// Board kernels
+//
+// One pass over the letters and answers counts the progress and marks the
+// mistakes.  A cell needs a letter if its answer is a letter or unknown
+// (a space), the same test as required, and is correct when its letter
+// equals the answer, so an unknown answer is only right while left blank
+// just like set_at counts it.  Any cell with a letter that differs from a
+// known answer is a mistake.  The vector versions do 64 cells per mask word
+// and leave the rest to the scalar one.
+// -------------------------------------------------------------------
+
+typedef void (*progress_kernel)(const char *letters, const char *answers, int n,
+        uint64_t *mistakes, board_progress& p);
+
+static int count_bits(uint64_t bits)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll(bits);
+#else
+    int count = 0;
+    for (; bits; bits &= bits - 1)
+        count++;
+    return count;
+#endif
+}
+
+static void progress_scalar(const char *letters, const char *answers, int n,
+        uint64_t *mistakes, board_progress& p)
+{
+    for (int i = 0; i < n; i++)
+    {
+        unsigned char answer = answers[i];
+        unsigned char lower = answer | 0x20;
+        bool letter = lower >= 'a' && lower <= 'z';
+        bool blank = letters[i] == ' ';
+        bool same = letters[i] == answers[i];
+        if (!blank && !same && answer != ' ' && mistakes)
+            mistakes[i / 64] |= uint64_t(1) << (i % 64);
+        if (!letter && answer != ' ')
+            continue;
+
+        p.cells++;
+        p.filled += !blank;
+        p.correct += same;
+    }
+}
+
+#ifdef BOARD_KERNELS_X86
+#ifdef __GNUC__
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// Masks of 16 cells, bit j for cell j
+TARGET_SSE2 static void classify_sse2(const char *letters, const char *answers,
+        unsigned& needed, unsigned& filled, unsigned& correct, unsigned& wrong)
+{
+    __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(letters));
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(answers));
+    __m128i space = _mm_set1_epi8(' ');
+
+    // Letters are the lower cased bytes in 'a'..'z', moved to the bottom of
+    // the signed range so one compare finds them
+    __m128i lower = _mm_or_si128(a, _mm_set1_epi8(0x20));
+    __m128i shifted = _mm_add_epi8(lower, _mm_set1_epi8(static_cast<char>(128 - 'a')));
+    __m128i letter = _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 26));
+
+    unsigned unknown = _mm_movemask_epi8(_mm_cmpeq_epi8(a, space));
+    unsigned blank = _mm_movemask_epi8(_mm_cmpeq_epi8(l, space));
+    unsigned same = _mm_movemask_epi8(_mm_cmpeq_epi8(l, a));
+    needed = _mm_movemask_epi8(letter) | unknown;
+    filled = needed & ~blank;
+    correct = needed & same;
+    wrong = ~(blank | unknown | same) & 0xffff;
+}
+
+TARGET_SSE2 static void progress_sse2(const char *letters, const char *answers, int n,
+        uint64_t *mistakes, board_progress& p)
+{
+    int blocks = n / 64;
+    for (int b = 0; b < blocks; b++)
+    {
+        uint64_t needed = 0, filled = 0, correct = 0, wrong = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            unsigned nd, f, c, w;
+            classify_sse2(letters + b * 64 + j * 16, answers + b * 64 + j * 16, nd, f, c, w);
+            needed |= uint64_t(nd) << (j * 16);
+            filled |= uint64_t(f) << (j * 16);
+            correct |= uint64_t(c) << (j * 16);
+            wrong |= uint64_t(w) << (j * 16);
+        }
+        p.cells += count_bits(needed);
+        p.filled += count_bits(filled);
+        p.correct += count_bits(correct);
+        if (mistakes)
+            mistakes[b] = wrong;
+    }
+
+    board_progress tail = { 0, 0, 0 };
+    progress_scalar(letters + blocks * 64, answers + blocks * 64, n - blocks * 64,
+            mistakes ? mistakes + blocks : 0, tail);
+    p.cells += tail.cells;
+    p.filled += tail.filled;
+    p.correct += tail.correct;
+}
+
+// Masks of 32 cells, bit j for cell j
+TARGET_AVX2 static void classify_avx2(const char *letters, const char *answers,
+        uint32_t& needed, uint32_t& filled, uint32_t& correct, uint32_t& wrong)
+{
+    __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(letters));
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(answers));
+    __m256i space = _mm256_set1_epi8(' ');
+
+    // See classify_sse2, the compare is a greater than the other way round
+    __m256i lower = _mm256_or_si256(a, _mm256_set1_epi8(0x20));
+    __m256i shifted = _mm256_add_epi8(lower, _mm256_set1_epi8(static_cast<char>(128 - 'a')));
+    __m256i letter = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), shifted);
+
+    uint32_t unknown = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, space));
+    uint32_t blank = _mm256_movemask_epi8(_mm256_cmpeq_epi8(l, space));
+    uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(l, a));
+    needed = static_cast<uint32_t>(_mm256_movemask_epi8(letter)) | unknown;
+    filled = needed & ~blank;
+    correct = needed & same;
+    wrong = ~(blank | unknown | same);
+}
+
+TARGET_AVX2 static void progress_avx2(const char *letters, const char *answers, int n,
+        uint64_t *mistakes, board_progress& p)
+{
+    int blocks = n / 64;
+    for (int b = 0; b < blocks; b++)
+    {
+        uint32_t nd[2], f[2], c[2], w[2];
+        classify_avx2(letters + b * 64, answers + b * 64, nd[0], f[0], c[0], w[0]);
+        classify_avx2(letters + b * 64 + 32, answers + b * 64 + 32, nd[1], f[1], c[1], w[1]);
+        p.cells += count_bits(nd[0] | uint64_t(nd[1]) << 32);
+        p.filled += count_bits(f[0] | uint64_t(f[1]) << 32);
+        p.correct += count_bits(c[0] | uint64_t(c[1]) << 32);
+        if (mistakes)
+            mistakes[b] = w[0] | uint64_t(w[1]) << 32;
+    }
+
+    board_progress tail = { 0, 0, 0 };
+    progress_scalar(letters + blocks * 64, answers + blocks * 64, n - blocks * 64,
+            mistakes ? mistakes + blocks : 0, tail);
+    p.cells += tail.cells;
+    p.filled += tail.filled;
+    p.correct += tail.correct;
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef __GNUC__
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    // The CPU has to have it and the OS has to save the ymm registers
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+static bool cpu_has_sse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#endif
+}
+#endif
+
+struct kernel_entry
+{
+    const char *name;
+    progress_kernel fn;
+    bool (*supported)();
+};
+
+static bool always()
+{
+    return true;
+}
+
+// Fastest first
+static const kernel_entry kernels[] = {
+#ifdef BOARD_KERNELS_X86
+    { "avx2", progress_avx2, cpu_has_avx2 },
+    { "sse2", progress_sse2, cpu_has_sse2 },
+#endif
+    { "scalar", progress_scalar, always }
+};
+static const int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+
+static const kernel_entry *best_kernel()
+{
+    for (int i = 0; i < kernel_count; i++)
+    {
+        if (kernels[i].supported())
+            return &kernels[i];
+    }
+    return &kernels[kernel_count - 1];
+}
+
+static std::atomic<const kernel_entry*> current_kernel(best_kernel());
+
+/**
+ * Counts the cells that need a letter, those filled in and those with the
+ * right letter, and optionally marks the mistakes.
+ * @param mistakes If not NULL, resized to a bit per cell and filled in.
+ * @return The counts, all zero for a board without a puzzle.
+ */
+board_progress crossword_board::progress(std::vector<uint64_t> *mistakes) const
+{
+    board_progress p = { 0, 0, 0 };
+    int n = xdim_ * ydim_;
+    if (mistakes)
+        mistakes->assign((n + 63) / 64, 0);
+    if (!letters_ || !answers_)
+        return p;
+
+    current_kernel.load()->fn(letters_, answers_, n,
+            mistakes && n ? &(*mistakes)[0] : 0, p);
+    return p;
+}
+
+const char *crossword_board::kernel()
+{
+    return current_kernel.load()->name;
+}
+
+bool crossword_board::select_kernel(const std::string& name)
+{
+    for (int i = 0; i < kernel_count; i++)
+    {
+        if (name == kernels[i].name && kernels[i].supported())
+        {
+            current_kernel = &kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
 // -------------------------------------------------------------------
 // Begin Helper Functions
 // -------------------------------------------------------------------
@@ -513,33 +1467,46 @@ void crossword_board::write_clues(TiXmlElement* parent, const clue_set& clues) c
  */
 void crossword_board::clear_data()
 {
-    if (letters_)
-        delete[] letters_;
-    if (layout_)
-        delete[] layout_;
-    if (answers_)
-        delete[] answers_;
-    across_.clear(); down_.clear();
+    delete[] letters_;
+    // The puzzle data goes away with the last board sharing it
+    puzzle_.reset();
     xdim_ = ydim_ = 0;
     layout_ = 0;
+    answers_ = 0;
     letters_ = 0;
+    wrong_ = 0;
+    start_history();
 
     initialized_ = false;
 }
 
 /**
- * Allocates memory to internal arrays and prepares the board.
- * SHOULD NOT BE CALLED ON A BOARD ALREADY CONTAINING ARRAYS, as this will 
- * result in memory leaks.
+ * Forgets the changes and starts a new history.  Ids are unique within a
+ * process and start from the clock so that a restarted server is unlikely
+ * to reuse the ids it handed out before.
+ */
+void crossword_board::start_history()
+{
+    static std::atomic<uint32_t> next_id(static_cast<uint32_t>(
+                std::chrono::system_clock::now().time_since_epoch().count()));
+    history_id_ = ++next_id;
+    version_ = 0;
+    history_.clear();
+    history_start_ = 0;
+}
+
+/**
+ * Allocates memory to internal arrays and prepares the board.  This creates a
+ * new puzzle_data that is not shared with any other board, any arrays the
+ * board already had are released.
  */
 void crossword_board::allocate_memory()
 {
+    puzzle_.reset(new puzzle_data(xdim_ * ydim_));
+    delete[] letters_;
     letters_ = new char[xdim_ * ydim_];
-    layout_ = new int[xdim_ * ydim_];
-    answers_ = new char[xdim_ * ydim_];
-
-    if (!letters_ || !layout_ || !answers_)
-        throw std::runtime_error("Unable to allocate memory");
+    layout_ = puzzle_->layout;
+    answers_ = puzzle_->answers;
 
     for (int i = 0; i < xdim_ * ydim_; i++)
         answers_[i] = letters_[i] = ' ';
@@ -549,3 +1516,157 @@ void crossword_board::allocate_memory()
 
     initialized_ = true;
 }
+
+/**
+ * Adds a clue to one of the puzzle's sets, its text to the puzzle's pool and
+ * its number to the layout.
+ * @param pos The cell, y * xdim + x.
+ */
+void crossword_board::add_clue(clue_set& set, int num, const char *text, size_t length,
+        int pos)
+{
+    set_clue_cell(pos, num);
+    if (length > max_clue_text)
+        throw std::runtime_error("A clue's text is too long");
+
+    std::string& pool = puzzle_->clue_text;
+    size_t offset = pool.size();
+    pool.append(text, length);
+    pool.push_back('\0');
+    set.add(crossword_clue(num, &pool, offset, length, pos % xdim_, pos / xdim_));
+}
+
+/**
+ * Puts a clue number in the layout, checking that it fits.
+ * @param pos The cell, y * xdim + x.
+ * @param num The clue number.
+ */
+void crossword_board::set_clue_cell(int pos, int num)
+{
+    if (pos < 0 || pos >= xdim_ * ydim_)
+        throw std::runtime_error("A clue is outside the board");
+    if (num <= 0 || num > max_clue)
+        throw std::runtime_error("A clue number is out of range");
+    layout_[pos] = static_cast<clue_number>(num);
+}
+
+/**
+ * Finds every word in the layout and records which words each cell belongs
+ * to, so word and clue lookups don't have to walk the board.  Must run after
+ * the walls and clue numbers are in place.
+ */
+void crossword_board::index_words()
+{
+    puzzle_data& p = *puzzle_;
+    p.across.index();
+    p.down.index();
+    p.words.clear();
+
+    int highest = 0;
+    for (int i = 0; i < xdim_ * ydim_; i++)
+    {
+        p.across_words[i] = p.down_words[i] = -1;
+        highest = std::max(highest, static_cast<int>(layout_[i]));
+    }
+    p.across_clues.assign(highest + 1, -1);
+    p.down_clues.assign(highest + 1, -1);
+
+    for (int dir = across_dir; dir <= down_dir; dir++)
+    {
+        int xvel = dir == across_dir ? 1 : 0;
+        int yvel = dir == down_dir ? 1 : 0;
+        int *cells = dir == across_dir ? p.across_words : p.down_words;
+        std::vector<int>& clues = dir == across_dir ? p.across_clues : p.down_clues;
+
+        for (int y = 0; y < ydim_; y++)
+        {
+            for (int x = 0; x < xdim_; x++)
+            {
+                // A word starts at an open cell after a wall or the edge
+                if (layout_[y * xdim_ + x] == wall_char)
+                    continue;
+                int px = x - xvel, py = y - yvel;
+                if (px >= 0 && py >= 0 && layout_[py * xdim_ + px] != wall_char)
+                    continue;
+
+                crossword_word w;
+                w.x = x;
+                w.y = y;
+                w.dir = dir;
+                w.clue = layout_[y * xdim_ + x];
+                w.length = 0;
+
+                int id = p.words.size();
+                for (int cx = x, cy = y; cx < xdim_ && cy < ydim_ &&
+                        layout_[cy * xdim_ + cx] != wall_char; cx += xvel, cy += yvel)
+                {
+                    cells[cy * xdim_ + cx] = id;
+                    w.length++;
+                }
+
+                p.words.push_back(w);
+                if (w.clue > 0)
+                    clues[w.clue] = id;
+            }
+        }
+    }
+}
+
+/**
+ * Counts the cells that still need the right letter, done after the letters
+ * are replaced wholesale.
+ */
+void crossword_board::count_wrong()
+{
+    board_progress p = progress();
+    wrong_ = p.cells - p.correct;
+}
+
+/**
+ * Whether cell i has to be filled in to win, walls and other punctuation in
+ * the answers don't.  Only ASCII letters count, whatever the locale, so this
+ * agrees with the board kernels.
+ */
+bool crossword_board::required(int i) const
+{
+    unsigned char lower = answers_[i] | 0x20;
+    return (lower >= 'a' && lower <= 'z') || answers_[i] == ' ';
+}
+
+/// Planes in the puzzle arena start on a boundary of this many bytes
+static const size_t cache_line = 64;
+
+static size_t plane_size(size_t bytes)
+{
+    return (bytes + cache_line - 1) & ~(cache_line - 1);
+}
+
+/**
+ * Allocates the layout, answer and word arrays for a board of size cells,
+ * all of them in one arena.
+ */
+crossword_board::puzzle_data::puzzle_data(int size)
+: across(), down(), clue_text(), arena(), layout(), answers(), across_words(), down_words(),
+    words(), across_clues(), down_clues(), xml_prefix(), binary_prefix()
+{
+    size_t words_size = plane_size(size * sizeof(int));
+    size_t layout_size = plane_size(size * sizeof(clue_number));
+    size_t total = 2 * words_size + layout_size + plane_size(size);
+
+    // new only promises alignment for the largest fundamental type, the
+    // spare line lets the first plane start on a boundary
+    arena = new char[total + cache_line];
+    void *start = arena;
+    size_t space = total + cache_line;
+    char *pos = static_cast<char*>(std::align(cache_line, total, start, space));
+
+    across_words = reinterpret_cast<int*>(pos);
+    down_words = reinterpret_cast<int*>(pos + words_size);
+    layout = reinterpret_cast<clue_number*>(pos + 2 * words_size);
+    answers = pos + 2 * words_size + layout_size;
+}
+
+crossword_board::puzzle_data::~puzzle_data()
+{
+    delete[] arena;
+}
@@ -1,18 +1,28 @@
 #pragma once
 #include <map>
 #include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <cstdint>
 #include "tinyxml.h"
 
+// A clue's text lives in the string pool of the board it came from, so a
+// clue (or a copy of one) is only good while that board's puzzle is
 class crossword_clue
 {
 public:
     // Default constructor creates a "non clue"
     crossword_clue();
 
-    crossword_clue(int num, const std::string& text, int x, int y);
+    // text_length bytes at offset in pool, which is followed by a NUL
+    crossword_clue(int num, const std::string *pool, size_t offset, size_t text_length,
+            int x, int y);
 
     int number() const;
-    const std::string& text() const;
+    // NUL terminated
+    const char *text() const;
+    size_t text_length() const;
     int x() const;
     int y() const;
 
@@ -24,15 +34,73 @@ public:
 private:
     // Data members
     int num_;
-    std::string text_;
-    std::string answer_;
+    const std::string *pool_;
+    size_t offset_, length_;
     int x_, y_;
 };
 
 std::ostream& operator<< (std::ostream& out, const crossword_clue& clue);
 
 // ----------------------------------------------------------
-typedef std::map<int, crossword_clue> clue_set;
+// The clues of one direction in number order.  Iterating gives (number, clue)
+// pairs like a map would, lookups and the clue after or before a number are
+// array reads.
+class clue_set
+{
+public:
+    typedef std::pair<int, crossword_clue> value_type;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+
+    clue_set();
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+    bool empty() const;
+
+    // NULL if there is no clue with that number
+    const crossword_clue *find(int num) const;
+    // The next clue after num and the last one before it, wrapping around.
+    // num doesn't have to be a clue.  NULL if the set is empty.
+    const crossword_clue *next(int num) const;
+    const crossword_clue *previous(int num) const;
+
+    // Clues may be added in any order, a later clue replaces an earlier one
+    // with the same number.  index must be called once they are all in.
+    void add(const crossword_clue& clue);
+    void index();
+
+private:
+    std::vector<value_type> clues_;
+    // By clue number up to the highest one: the position of the clue with
+    // that number or -1, and of the clue after and before it
+    std::vector<int> positions_, next_, previous_;
+};
+
+// What the layout holds for a cell: a clue number, 0 or wall_char
+typedef int16_t clue_number;
+
+// A run of open cells across or down, bounded by walls or the edge of the
+// board
+struct crossword_word
+{
+    int x, y;
+    int length;
+    int dir;
+    // The number in the first cell, 0 if the word has no clue
+    int clue;
+};
+
+// How far along a board is.  Only cells that need a letter to win count.
+struct board_progress
+{
+    int cells;
+    // Cells with any letter
+    int filled;
+    // Cells with the right letter.  A cell with an unknown answer is only
+    // right while it is blank, as won sees it.
+    int correct;
+};
 
 class crossword_board
 {
@@ -41,15 +109,32 @@ public:
     static const int across_dir;
     static const int down_dir;
     static const int wall_char;
+    // Largest clue number a board can have
+    static const int max_clue;
+    // Longest clue text, the binary format has a u16 for the length
+    static const size_t max_clue_text;
+    // Letter changes kept for changes_since
+    static const int history_size;
+    // Version written by write_binary
+    static const int binary_version;
 
     // -- Interface Functions --
     // Ctor / Dtor
     crossword_board();
     ~crossword_board();
 
+    // Copies share the puzzle (layout, answers and clues), only the letters
+    // are duplicated
+    crossword_board(const crossword_board& other);
+    crossword_board& operator=(const crossword_board& rhs);
+    // Moves take the puzzle and the letters, other is left empty
+    crossword_board(crossword_board&& other) noexcept;
+    crossword_board& operator=(crossword_board&& rhs) noexcept;
+
     // True if the board contains useful information
     bool initialized() const;
-    // Returns true if the letters array matches the answers array
+    // Returns true if the letters array matches the answers array.  Constant
+    // time, set_at keeps count of the cells still wrong.
     bool won() const;
 
     // Size accessors
@@ -65,35 +150,133 @@ public:
 
     // User solution accessor/mutator
     char at(int x, int y) const;
-    char& at(int x, int y);
+    void set_at(int x, int y, char ch);
+
+    // Every set_at is a change.  version() counts the changes in the board's
+    // current history, which history_id() names.  Reading or copying a board
+    // starts a new history, a move keeps it.
+    uint32_t history_id() const;
+    uint32_t version() const;
+    // Appends x, y and the letter of every cell changed after version, once
+    // each with its latest letter, and returns true.  Returns false if only a
+    // full snapshot will do: version is older than the kept changes, newer
+    // than the board, or the board is too big for byte coordinates.
+    bool changes_since(uint32_t version, std::string& cells) const;
 
     // Clue accessors (invidual clues, entire directions, and size of directions)
     const crossword_clue& clue(int dir, int num) const;
     const crossword_clue& next_clue(int dir, int num) const;
+    const crossword_clue& previous_clue(int dir, int num) const;
     const clue_set& clues(int dir) const;
 
     // Gets the x,y coordinate of the start of a clue
     // x, y are out coordinates
     void start_of_clue(int clue, int &x, int &y) const;
 
+    // Word accessors, built when the board is read.  Word ids index word(),
+    // word_at and word_of_clue return -1 if there is no such word.
+    int word_at(int x, int y, int dir) const;
+    int word_of_clue(int dir, int clue) const;
+    const crossword_word& word(int id) const;
+
+    // Counts the cells, filled cells and correct cells in one pass over the
+    // grid.  If mistakes is given it gets a bit per cell, cell i at bit i % 64
+    // of word i / 64, set where a letter is filled in and isn't the answer.
+    // Cells with an unknown answer are never mistakes, cells that don't need
+    // a letter are if they have the wrong one.
+    board_progress progress(std::vector<uint64_t> *mistakes = 0) const;
+    // The implementation progress uses, "avx2", "sse2" or "scalar".  The
+    // fastest one the CPU has is picked, select_kernel overrides it and
+    // returns false if the CPU can't run the one named.
+    static const char *kernel();
+    static bool select_kernel(const std::string& name);
+
     // Board serialization routines
     void read(std::istream& in);
+    // Same from a file, false if it can't be opened
+    bool read_file(const std::string& path);
     void write(std::ostream& out, bool letters = true) const;
+    // Compact binary form of the same data.  read_binary decodes straight
+    // from the caller's buffer.
+    void read_binary(const char *data, size_t size);
+    void write_binary(std::string& out, bool letters = true) const;
+
+    // The board with its letters in either format, for sending.  Everything
+    // but the letters is encoded once per puzzle, see snapshot_stats.  The two
+    // halves are also available separately so they can be sent without
+    // joining them first.
+    void write_snapshot(std::string& out, bool binary) const;
+    const std::string& snapshot_puzzle(bool binary) const;
+    void snapshot_letters(std::string& out, bool binary) const;
+    static void snapshot_stats(long& hits, long& misses);
 
 private:
     // -- Helper functions --
+    void read_document(TiXmlDocument& doc);
     void read_clues(TiXmlElement* clue_elem, clue_set& set);
+    void add_clue(clue_set& set, int num, const char *text, size_t length, int pos);
     void write_clues(TiXmlElement* parent, const clue_set& set) const;
+    void write_binary_puzzle(std::string& out, bool letters) const;
 
     void clear_data();
     void allocate_memory();
+    void set_clue_cell(int pos, int num);
+    void start_history();
+    void index_words();
+    void count_wrong();
+    bool required(int i) const;
+
+    // The parts of a board that come from the puzzle file and never change
+    // while it is played.  Boards copied from each other share one.
+    struct puzzle_data
+    {
+        puzzle_data(int size);
+        ~puzzle_data();
+
+        clue_set across, down;
+        // Every clue's text, each followed by a NUL
+        std::string clue_text;
+
+        // One allocation holds a plane per cell array, each starting on its
+        // own cache line, so a scan of one array reads nothing else
+        char *arena;
+        clue_number *layout;
+        char *answers;
+        // The across and down word of every cell
+        int *across_words;
+        int *down_words;
+
+        std::vector<crossword_word> words;
+        // Word ids by clue number
+        std::vector<int> across_clues, down_clues;
+
+        // Encoded by the first write_snapshot in each format, everything up
+        // to the letters
+        std::once_flag xml_once, binary_once;
+        std::string xml_prefix, binary_prefix;
+    };
 
     // -- Data Members --
     int xdim_, ydim_;
-    clue_set across_, down_;
+    std::shared_ptr<puzzle_data> puzzle_;
     char *letters_;
-    int *layout_;
+    // Point into puzzle_
+    clue_number *layout_;
     char *answers_;
+    // Cells that need a letter and don't have the right one
+    int wrong_;
     bool initialized_;
+
+    // The latest changes, oldest at history_start_ once history_size of them
+    // have been made
+    struct cell_change
+    {
+        int32_t cell;
+        char letter;
+    };
+    uint32_t history_id_;
+    uint32_t version_;
+    std::vector<cell_change> history_;
+    size_t history_start_;
 };
 
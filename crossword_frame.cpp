@@ -13,7 +13,10 @@ crossword_frame::crossword_frame()
     : wxFrame(NULL, wxID_ANY, wxT("Crossword App"), wxDefaultPosition, wxSize(600, 622),
             wxDEFAULT_FRAME_STYLE & ~ (wxRESIZE_BORDER | wxRESIZE_BORDER | wxMAXIMIZE_BOX)),
     board_(),
-    display_(0)
+    display_(0),
+    synced_(false),
+    synced_history_(0),
+    synced_version_(0)
 {
     // Setup the socket for later use
     socket_ = new wxSocketClient();
@@ -69,20 +72,20 @@ void crossword_frame::change()
             return;
 
         // Set the current direction's clue
-        wxString clue_text(board_.clue(dir, cluenum).text().c_str(), wxConvUTF8);
+        wxString clue_text(board_.clue(dir, cluenum).text(), wxConvUTF8);
         wxString status_text;
         status_text << cluenum << wxT(") ") << clue_text;
         this->SetTitle(status_text);
 
         // Set the opposite direction's clue
-        wxString oppclue_text(board_.clue(oppdir, cluenum).text().c_str(), wxConvUTF8);
+        wxString oppclue_text(board_.clue(oppdir, cluenum).text(), wxConvUTF8);
         status_bar_->SetStatusText(oppclue_text);
     }
 }
 
 void crossword_frame::set_letter(int x, int y, char ch)
 {
-    board_.at(x, y) = ch;
+    board_.set_at(x, y, ch);
     std::string data;
     data.push_back( static_cast<char>(x) );
     data.push_back( static_cast<char>(y) );
@@ -151,11 +154,19 @@ void crossword_frame::on_update(std::string data)
     int x = static_cast<unsigned char>(data[0]);
     int y = static_cast<unsigned char>(data[1]);
     char ch = data[2];
+    synced_version_++;
 
     // If the message checks out update the board
     if (x >= 0 && x < board_.xdim() && y >= 0 && y < board_.ydim() &&
             (isalpha(ch) || ch == ' '))
-        board_.at(x, y) = ch;
+        board_.set_at(x, y, ch);
+}
+
+void crossword_frame::on_update_batch(std::string data)
+{
+    // The display is repainted once after the whole batch is applied
+    for (size_t i = 0; i + 3 <= data.size(); i += 3)
+        on_update(data.substr(i, 3));
 }
 
 void crossword_frame::on_cursor(std::string data)
@@ -176,6 +187,24 @@ void crossword_frame::on_cursor(std::string data)
         return;
 }
 
+void crossword_frame::on_cursor_batch(std::string data)
+{
+    // Shows the words of everyone in the batch together
+    bool clear = true;
+    for (size_t i = 0; i + 3 <= data.size(); i += 3)
+    {
+        int x = static_cast<unsigned char>(data[i]);
+        int y = static_cast<unsigned char>(data[i + 1]);
+        int d = static_cast<unsigned char>(data[i + 2]);
+        if (x < board_.xdim() && y < board_.ydim() &&
+                (d == crossword_board::across_dir || d == crossword_board::down_dir))
+        {
+            display_->set_other_cursors(x, y, d, clear);
+            clear = false;
+        }
+    }
+}
+
 void crossword_frame::on_win(std::string data)
 {
     int seconds = atoi(data.c_str());
@@ -192,12 +221,44 @@ void crossword_frame::on_win(std::string data)
 
 void crossword_frame::on_board_data(std::string data)
 {
+    // Until the patch that follows the board says which version this is
+    synced_ = false;
+
     std::stringstream ss;
     ss.write(data.c_str(), data.length());
 
     set_board(ss);
 }
 
+void crossword_frame::on_binary_board_data(std::string data)
+{
+    synced_ = false;
+    try
+    {
+        board_.read_binary(data.data(), data.size());
+    }
+    catch (std::runtime_error& e)
+    {
+        on_exception(e.what());
+    }
+    show_board();
+}
+
+void crossword_frame::on_board_patch(std::string data)
+{
+    if (data.size() < 8 || !board_.initialized())
+        return;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data.data());
+    synced_history_ = static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    uint32_t version = static_cast<uint32_t>(p[4]) << 24 | p[5] << 16 | p[6] << 8 | p[7];
+
+    // The cells count towards the version like any other update
+    synced_version_ = version - (data.size() - 8) / 3;
+    synced_ = true;
+    on_update_batch(data.substr(8));
+    show_board();
+}
+
 void crossword_frame::on_socket_event(wxSocketEvent& event)
 {
     if (event.GetSocketEvent() == wxSOCKET_CONNECTION)
@@ -241,24 +302,46 @@ void crossword_frame::on_exception(const char* str)
 
 void crossword_frame::on_connect()
 {
+    // Ask for the binary board, the server sends XML if it doesn't have our
+    // version
+    std::string request = room_;
+    request.push_back('\0');
+    request.push_back(static_cast<char>(crossword_board::binary_version));
+    request.push_back(static_cast<char>(MESSAGE_PROTOCOL_VERSION));
+    if (synced_)
+    {
+        // We have been here before, the server only has to send what we
+        // missed
+        request.push_back(static_cast<char>(MESSAGE_RESYNC_FLAG));
+        for (int shift = 24; shift >= 0; shift -= 8)
+            request.push_back(static_cast<char>((synced_history_ >> shift) & 0xff));
+        for (int shift = 24; shift >= 0; shift -= 8)
+            request.push_back(static_cast<char>((synced_version_ >> shift) & 0xff));
+    }
+
     std::string message;
-    message = create_packet(message, MESSAGE_TYPE_BOARD_REQUEST);
+    message = create_packet(request, MESSAGE_TYPE_BOARD_REQUEST);
 
     send(message);
 }
 
 void crossword_frame::on_recieve_data()
 {
-    char header[3];
+    unsigned char header[5];
     socket_->Read(header, 3);
     /*
      * Byte 1 = type
      * Byte 2 & 3 = size
+     * or with the extended flag set in the type
+     * Byte 2 - 5 = size
      */
-    int type = header[0];
-	size_t sizeH = static_cast<size_t>(header[1]) * 256;
-	size_t sizeL = static_cast<unsigned char >(header[2]);
-    size_t size = sizeH + sizeL;
+    int type = header[0] & ~MESSAGE_EXTENDED_FLAG;
+    size_t size = header[1] * 256 + header[2];
+    if (header[0] & MESSAGE_EXTENDED_FLAG)
+    {
+        socket_->Read(header + 3, 2);
+        size = (size << 16) + header[3] * 256 + header[4];
+    }
     std::string payload;
     if (size > 0)
     {
@@ -272,14 +355,22 @@ void crossword_frame::on_recieve_data()
     }
     else if (type == MESSAGE_TYPE_BOARD)
         on_board_data(payload);
+    else if (type == MESSAGE_TYPE_BINARY_BOARD)
+        on_binary_board_data(payload);
     else if (type == MESSAGE_TYPE_UPDATE)
         on_update(payload);
+    else if (type == MESSAGE_TYPE_UPDATE_BATCH)
+        on_update_batch(payload);
     else if (type == MESSAGE_TYPE_CURSOR)
         on_cursor(payload);
+    else if (type == MESSAGE_TYPE_CURSOR_BATCH)
+        on_cursor_batch(payload);
     else if (type == MESSAGE_TYPE_WIN)
         on_win(payload);
     else if (type == MESSAGE_TYPE_PAUSE)
         on_pause(payload);
+    else if (type == MESSAGE_TYPE_BOARD_PATCH)
+        on_board_patch(payload);
     else
     {
         // Unknown type
@@ -295,7 +386,7 @@ void crossword_frame::on_connect_menu(wxCommandEvent& WXUNUSED(event))
     if (result == wxOK || result == wxID_OK)
     {
         wxIPV4address addr = dialog.address();
-        connect_to_address(addr);
+        connect_to_address(addr, dialog.room());
     }
 }
 
@@ -372,6 +463,11 @@ void crossword_frame::set_board(std::istream& in)
     {
         on_exception(e.what());
     }
+    show_board();
+}
+
+void crossword_frame::show_board()
+{
     // If there is no display, create one
     if (!display_)
     {
@@ -382,7 +478,11 @@ void crossword_frame::set_board(std::istream& in)
     display_->SetFocus();
 }
 
-void crossword_frame::connect_to_address(wxIPaddress& addr)
+void crossword_frame::connect_to_address(wxIPaddress& addr, const std::string& room)
 {
+    // A patch only makes sense for the game we were in
+    if (room != room_)
+        synced_ = false;
+    room_ = room;
     socket_->Connect(addr, false);
 }
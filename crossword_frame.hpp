@@ -12,6 +12,16 @@
 #define MESSAGE_TYPE_PAUSE 6
 #define MESSAGE_TYPE_SOLVE_WORD 7
 #define MESSAGE_TYPE_SOLVE_LETTER 8
+#define MESSAGE_TYPE_BINARY_BOARD 9
+#define MESSAGE_TYPE_UPDATE_BATCH 10
+#define MESSAGE_TYPE_CURSOR_BATCH 11
+#define MESSAGE_TYPE_BOARD_PATCH 12
+
+// Set on the type of packets with a four byte size, see crossword_protocol.h
+#define MESSAGE_EXTENDED_FLAG 0x80
+#define MESSAGE_PROTOCOL_VERSION 5
+// Board request flag asking for only the cells changed since a version
+#define MESSAGE_RESYNC_FLAG 0x02
 
 class crossword_frame : public wxFrame
 {
@@ -31,6 +41,15 @@ private:
     display_panel*      display_;
     wxSocketClient*     socket_;
     wxStatusBar*        status_bar_;
+    // Sent with the board request, picks the game on the server
+    std::string         room_;
+    // The server's history and version of board_, for rejoining room_ with
+    // a patch instead of the whole board.  The version only counts the cells
+    // received so it may lag behind, the cells in the patch are just sent
+    // again.
+    bool                synced_;
+    uint32_t            synced_history_;
+    uint32_t            synced_version_;
 
     // -- Event Handlers --
     void on_quit(wxCommandEvent& event);
@@ -43,9 +62,13 @@ private:
     // -- Message Handlers --
     void on_pause(std::string data);
     void on_update(std::string data);
+    void on_update_batch(std::string data);
     void on_cursor(std::string data);
+    void on_cursor_batch(std::string data);
     void on_win(std::string data);
     void on_board_data(std::string data);
+    void on_binary_board_data(std::string data);
+    void on_board_patch(std::string data);
     void on_connect();
     void on_recieve_data();
 
@@ -56,6 +79,7 @@ private:
     std::string create_packet(const std::string& payload, int type) const;
     void send(const std::string& message);
     void set_board(std::istream& in);
-    void connect_to_address(wxIPaddress& addr);
+    void show_board();
+    void connect_to_address(wxIPaddress& addr, const std::string& room);
 };
 
@@ -0,0 +1,350 @@
+#include "crossword_player.h"
+#include "crossword_protocol.h"
+
+/// Default queue thresholds
+send_limits::send_limits()
+: low_watermark(16 * 1024), high_watermark(64 * 1024), drop_limit(1024 * 1024)
+{
+}
+
+/**
+ * Constructor.  The socket is made non blocking and is deleted along with the
+ * player.
+ */
+crossword_player::crossword_player(kissnet::tcp_socket *sock, const send_limits& limits)
+: sock_(sock), limits_(limits), out_(), in_(), room_(0), board_version_(0),
+    protocol_version_(1), recording_id_(-1), spectator_(false), resync_(false),
+    resync_history_(0), resync_version_(0), corked_(false), lagging_(false), removed_(false)
+{
+    sock_->set_nonblocking(true);
+}
+
+/// Destructor
+crossword_player::~crossword_player()
+{
+    delete sock_;
+}
+
+/**
+ * Accessor for the player's socket.
+ */
+kissnet::tcp_socket *crossword_player::socket() const
+{
+    return sock_;
+}
+
+/**
+ * Accessor for the decoder of this player's incoming packets.
+ */
+frame_reader& crossword_player::input()
+{
+    return in_;
+}
+
+/**
+ * Queues a packet for this player.  Nothing is written until flush is called.
+ * While the player is lagging UPDATE and CURSOR packets only replace the
+ * previously held back packet for the same cell or the same player's cursor.
+ * @param packet A complete packet including the header.
+ * @param from The player whose cursor a CURSOR packet carries.
+ * @return False if the queue has grown past the drop limit.
+ */
+bool crossword_player::send(const std::string& packet, const crossword_player *from)
+{
+    if (packet.empty() || hold_back(packet.data(), packet.size(), from))
+        return true;
+
+    size_t before = out_.size();
+    out_.append(packet);
+    return queued(before);
+}
+
+/**
+ * Queues a packet shared with other players, by reference if it is large.
+ * @param packet A complete packet including the header.
+ * @param from The player whose cursor a CURSOR packet carries.
+ * @return False if the queue has grown past the drop limit.
+ */
+bool crossword_player::send(const kissnet::shared_buffer& packet,
+        const crossword_player *from)
+{
+    if (packet.empty() || hold_back(packet.data(), packet.size(), from))
+        return true;
+
+    size_t before = out_.size();
+    out_.append(packet);
+    return queued(before);
+}
+
+/**
+ * Queues a packet made of several pieces, one after the other.  Only the
+ * bytes queued before this packet count toward the drop limit, so one large
+ * packet doesn't get a player dropped.
+ * @param parts The pieces of the packet, the first one starts with the header.
+ * @param count The number of pieces.
+ * @return False if the queue has grown past the drop limit.
+ */
+bool crossword_player::send(const kissnet::shared_buffer * const *parts, int count)
+{
+    if (count == 0 || parts[0]->empty())
+        return true;
+    if (count == 1)
+        return send(*parts[0]);
+
+    // Keeps the order with anything held back
+    if (lagging_)
+        queue_coalesced();
+
+    size_t before = out_.size();
+    for (int i = 0; i < count; i++)
+        out_.append(*parts[i]);
+    return queued(before);
+}
+
+/**
+ * While the player is lagging UPDATE and CURSOR packets only replace the
+ * previously held back packet for the same cell or the same player's cursor.
+ * Anything else has to keep its order relative to the held back packets,
+ * which are queued ahead of it.
+ * @return True if the packet was held back.
+ */
+bool crossword_player::hold_back(const char *packet, size_t size,
+        const crossword_player *from)
+{
+    if (!lagging_)
+        return false;
+
+    int type = packet[0];
+    if ((type == UPDATE_TYPE || type == UPDATE_BATCH_TYPE) && size % 3 == 0)
+    {
+        for (size_t i = HEADER_SIZE; i < size; i += 3)
+        {
+            int x = static_cast<unsigned char>(packet[i]);
+            int y = static_cast<unsigned char>(packet[i + 1]);
+            coalesced_updates_[y * 256 + x] = packet[i + 2];
+        }
+        return true;
+    }
+    if (type == CURSOR_TYPE)
+    {
+        // Rooms hold a handful of players, a search beats a map
+        for (size_t i = 0; i < coalesced_cursors_.size(); i++)
+        {
+            if (coalesced_cursors_[i].first == from)
+            {
+                coalesced_cursors_[i].second.assign(packet, size);
+                return true;
+            }
+        }
+        coalesced_cursors_.push_back(std::make_pair(from, std::string(packet, size)));
+        return true;
+    }
+
+    queue_coalesced();
+    return false;
+}
+
+/**
+ * Checks the queue after a packet was added.  Spectators are never lagging,
+ * they have nothing to throttle and the batches they share can't be
+ * coalesced.
+ * @param before The queue size before the packet.
+ * @return False if the queue had grown past the drop limit.
+ */
+bool crossword_player::queued(size_t before)
+{
+    if (before > limits_.drop_limit)
+        return false;
+    if (out_.size() > limits_.high_watermark && !spectator_)
+        lagging_ = true;
+
+    return true;
+}
+
+/**
+ * Writes queued data until the socket would block.  Once the queue drains
+ * below the low watermark the held back packets are queued and the player is
+ * no longer lagging.  A corked socket is uncorked once the queue is empty.
+ * Socket errors are thrown.
+ * @param calls If not NULL, counts the system calls made.
+ * @return The number of bytes written.
+ */
+size_t crossword_player::flush(unsigned long *calls)
+{
+    size_t written = out_.flush(*sock_, calls);
+
+    if (lagging_ && out_.size() < limits_.low_watermark)
+    {
+        lagging_ = false;
+        queue_coalesced();
+        written += out_.flush(*sock_, calls);
+        if (out_.size() > limits_.high_watermark)
+            lagging_ = true;
+    }
+
+    if (corked_ && out_.empty())
+    {
+        corked_ = false;
+        sock_->set_cork(false);
+    }
+    return written;
+}
+
+/**
+ * Corks the socket until the queue drains.  Socket errors are thrown.
+ */
+void crossword_player::cork()
+{
+    if (!corked_)
+    {
+        sock_->set_cork(true);
+        corked_ = true;
+    }
+}
+
+bool crossword_player::pending() const
+{
+    return !out_.empty();
+}
+
+size_t crossword_player::queued() const
+{
+    return out_.size();
+}
+
+bool crossword_player::lagging() const
+{
+    return lagging_;
+}
+
+crossword_room *crossword_player::room() const
+{
+    return room_;
+}
+
+void crossword_player::set_room(crossword_room *room)
+{
+    room_ = room;
+}
+
+bool crossword_player::removed() const
+{
+    return removed_;
+}
+
+void crossword_player::set_removed(bool removed)
+{
+    removed_ = removed;
+}
+
+/**
+ * Accessor for the board format this player asked for.
+ */
+int crossword_player::board_version() const
+{
+    return board_version_;
+}
+
+void crossword_player::set_board_version(int version)
+{
+    board_version_ = version;
+}
+
+/**
+ * Accessor for the protocol version, which decides whether this player can
+ * take extended headers.
+ */
+int crossword_player::protocol_version() const
+{
+    return protocol_version_;
+}
+
+void crossword_player::set_protocol_version(int version)
+{
+    protocol_version_ = version;
+}
+
+bool crossword_player::spectator() const
+{
+    return spectator_;
+}
+
+void crossword_player::set_spectator()
+{
+    spectator_ = true;
+}
+
+bool crossword_player::resync(uint32_t& history, uint32_t& version) const
+{
+    history = resync_history_;
+    version = resync_version_;
+    return resync_;
+}
+
+void crossword_player::set_resync(uint32_t history, uint32_t version)
+{
+    resync_ = true;
+    resync_history_ = history;
+    resync_version_ = version;
+}
+
+void crossword_player::clear_resync()
+{
+    resync_ = false;
+}
+
+int crossword_player::recording_id() const
+{
+    return recording_id_;
+}
+
+void crossword_player::set_recording_id(int id)
+{
+    recording_id_ = id;
+}
+
+/**
+ * Moves the held back packets onto the send queue.
+ */
+void crossword_player::queue_coalesced()
+{
+    // Players that know batches get the held back letters in as few frames as
+    // fit in a short header
+    const size_t max_cells = protocol_version_ >= 3 ? 0xffff / 3 : 1;
+    std::string packet;
+    size_t cells = 0;
+    std::map<int, char>::const_iterator it = coalesced_updates_.begin();
+    for (; it != coalesced_updates_.end(); it++)
+    {
+        packet.push_back(static_cast<char>(it->first % 256));
+        packet.push_back(static_cast<char>(it->first / 256));
+        packet.push_back(it->second);
+        if (++cells == max_cells)
+        {
+            queue_updates(packet, cells);
+            packet.clear();
+            cells = 0;
+        }
+    }
+    if (cells > 0)
+        queue_updates(packet, cells);
+    coalesced_updates_.clear();
+
+    for (size_t i = 0; i < coalesced_cursors_.size(); i++)
+        out_.append(coalesced_cursors_[i].second);
+    coalesced_cursors_.clear();
+}
+
+/**
+ * Queues count cells as an UPDATE, or an UPDATE_BATCH if there is more than
+ * one.
+ */
+void crossword_player::queue_updates(const std::string& cells, size_t count)
+{
+    char header[HEADER_SIZE];
+    header[0] = static_cast<char>(count == 1 ? UPDATE_TYPE : UPDATE_BATCH_TYPE);
+    header[1] = static_cast<char>(cells.size() >> 8);
+    header[2] = static_cast<char>(cells.size() & 0xff);
+    out_.append(header, HEADER_SIZE);
+    out_.append(cells);
+}
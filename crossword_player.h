@@ -0,0 +1,115 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "kissnet.h"
+#include "send_queue.h"
+#include "frame_reader.h"
+
+class crossword_room;
+
+// Outbound queue thresholds in bytes.  Above high_watermark a player is
+// lagging: its UPDATE and CURSOR packets are coalesced and its input is no
+// longer read.  It catches up once the queue drains below low_watermark and is
+// dropped if the queue ever grows past drop_limit.
+struct send_limits
+{
+    send_limits();
+
+    size_t low_watermark;
+    size_t high_watermark;
+    size_t drop_limit;
+};
+
+class crossword_player
+{
+public:
+    // Takes ownership of the socket
+    crossword_player(kissnet::tcp_socket *sock, const send_limits& limits);
+    ~crossword_player();
+
+    kissnet::tcp_socket *socket() const;
+    // Decoder for the packets this player sends
+    frame_reader& input();
+
+    // Queues a complete packet.  Returns false if the player has fallen so far
+    // behind that it should be dropped.  from is the player a CURSOR packet
+    // is about, a lagging player keeps the latest one of each.
+    bool send(const std::string& packet, const crossword_player *from = 0);
+    // Same for a packet shared with other players, which isn't copied unless
+    // it is small
+    bool send(const kissnet::shared_buffer& packet, const crossword_player *from = 0);
+    // Same for a packet given in pieces, the header first
+    bool send(const kissnet::shared_buffer * const *parts, int count);
+    // Writes as much queued data as the socket takes without blocking and
+    // returns the number of bytes written.  calls, if given, is incremented
+    // for every system call.
+    size_t flush(unsigned long *calls = 0);
+    // Holds back partial segments until the queue next drains, for packets
+    // where filling segments matters more than latency
+    void cork();
+
+    // True if there is queued data waiting for the socket
+    bool pending() const;
+    // Bytes waiting for the socket
+    size_t queued() const;
+    bool lagging() const;
+
+    // The room this player joined, NULL until it sends a board request
+    crossword_room *room() const;
+    void set_room(crossword_room *room);
+
+    bool removed() const;
+    void set_removed(bool removed);
+
+    // Binary board version asked for in the board request, 0 for XML
+    int board_version() const;
+    void set_board_version(int version);
+    // Protocol version from the board request, 1 for old clients
+    int protocol_version() const;
+    void set_protocol_version(int version);
+    // Spectators watch a room without playing, nothing they send changes it.
+    // A connection that joins as a spectator stays one.
+    bool spectator() const;
+    void set_spectator();
+    // Board history id and version the player last saw, false if its board
+    // request didn't ask to resync
+    bool resync(uint32_t& history, uint32_t& version) const;
+    void set_resync(uint32_t history, uint32_t version);
+    void clear_resync();
+    // Number of this player in the game recording, -1 until it sends something
+    int recording_id() const;
+    void set_recording_id(int id);
+
+private:
+    // Not copyable
+    crossword_player(const crossword_player&);
+    crossword_player& operator=(const crossword_player&);
+
+    bool hold_back(const char *packet, size_t size, const crossword_player *from);
+    bool queued(size_t before);
+    void queue_coalesced();
+    void queue_updates(const std::string& cells, size_t count);
+
+    kissnet::tcp_socket *sock_;
+    send_limits limits_;
+    send_queue out_;
+    frame_reader in_;
+    crossword_room *room_;
+    int board_version_;
+    int protocol_version_;
+    int recording_id_;
+    bool spectator_;
+    bool resync_;
+    uint32_t resync_history_;
+    uint32_t resync_version_;
+    bool corked_;
+    bool lagging_;
+    bool removed_;
+
+    // Latest letter per cell and latest CURSOR packet of each player held
+    // back while lagging, the players in the order they first moved
+    std::map<int, char> coalesced_updates_;
+    std::vector<std::pair<const crossword_player*, std::string> > coalesced_cursors_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+// Message types, the first byte of every packet.  The client side spells
+// these MESSAGE_TYPE_* in crossword_frame.hpp.
+#define BOARD_REQUEST_TYPE 1
+#define BOARD_TYPE 2
+#define UPDATE_TYPE 3
+#define CURSOR_TYPE 4
+#define WIN_TYPE 5
+#define PAUSE_TYPE 6
+#define SOLVE_WORD_TYPE 7
+#define SOLVE_LETTER_TYPE 8
+#define BINARY_BOARD_TYPE 9
+// Any number of x, y, ch triples.  Only sent to peers with protocol version 3
+// or later, older ones get an UPDATE per cell.
+#define UPDATE_BATCH_TYPE 10
+// Cursor triples of several players, sent once per tick to peers with
+// protocol version 4 or later
+#define CURSOR_BATCH_TYPE 11
+// A four byte board history id and version followed by any number of x, y,
+// ch triples.  Sent to peers with protocol version 5 or later after every
+// board, with no cells, and in place of the board when they resync.
+#define BOARD_PATCH_TYPE 12
+
+// Every packet starts with a type byte and a two byte big endian payload size
+#define HEADER_SIZE 3
+
+// A type byte with EXTENDED_FLAG set is followed by a four byte big endian
+// size instead, for payloads over 65535 bytes.  Only peers that announced
+// protocol version 2 or later in their board request get these.
+#define EXTENDED_FLAG 0x80
+#define EXTENDED_HEADER_SIZE 5
+#define PROTOCOL_VERSION 5
+// Bigger incoming frames are treated as a broken connection
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+// A BOARD_REQUEST payload is the room id, optionally followed by a NUL, a
+// byte naming the newest binary board version the client reads and a byte
+// with its protocol version.  Clients that send a binary board version get a
+// BINARY_BOARD instead of the XML BOARD.
+//
+// Protocol version 4 clients may add a byte of flags.  With SPECTATOR_FLAG
+// set the client only watches the room: it gets every broadcast but nothing
+// it sends is applied.
+#define SPECTATOR_FLAG 0x01
+// Protocol version 5 clients rejoining a room may set RESYNC_FLAG and follow
+// the flags with the four byte big endian history id and version of the last
+// BOARD_PATCH they got, plus one for every cell they were sent since.  If the
+// room's board still remembers that far back they get a BOARD_PATCH with the
+// cells changed since instead of the whole board.
+#define RESYNC_FLAG 0x02
@@ -0,0 +1,209 @@
+#include "crossword_room.h"
+#include <algorithm>
+
+/**
+ * Constructor.  The board starts as a copy of puzzle, sharing its puzzle data.
+ * @param id The name clients use to join this room.
+ * @param puzzle The board to play.
+ */
+crossword_room::crossword_room(const std::string& id, const crossword_board& puzzle)
+: id_(id), board_(puzzle), players_(), spectators_(), spectator_batch_(),
+    empty_since_(time(NULL)), start_time_(0), elapsed_time_(0), paused_(false), journal_id_(-1)
+{
+}
+
+/**
+ * Accessor for the room's name.
+ */
+const std::string& crossword_room::id() const
+{
+    return id_;
+}
+
+/**
+ * Accessor for the board being played in this room.
+ */
+crossword_board& crossword_room::board()
+{
+    return board_;
+}
+
+const crossword_board& crossword_room::board() const
+{
+    return board_;
+}
+
+/**
+ * Adds a player to the room.  Adding a player twice has no effect.
+ */
+void crossword_room::add_player(crossword_player *player)
+{
+    if (std::find(players_.begin(), players_.end(), player) == players_.end())
+        players_.push_back(player);
+    empty_since_ = 0;
+}
+
+/**
+ * Removes a player from the room, if present.
+ */
+void crossword_room::remove_player(crossword_player *player)
+{
+    players_.erase(std::remove(players_.begin(), players_.end(), player),
+            players_.end());
+    spectators_.erase(std::remove(spectators_.begin(), spectators_.end(), player),
+            spectators_.end());
+    if (players_.empty() && spectators_.empty() && empty_since_ == 0)
+        empty_since_ = time(NULL);
+
+    for (size_t i = 0; i < held_cursors_.size(); i++)
+    {
+        if (held_cursors_[i].first == player)
+        {
+            held_cursors_.erase(held_cursors_.begin() + i);
+            break;
+        }
+    }
+}
+
+/**
+ * Accessor for the players in the room.
+ */
+const std::vector<crossword_player*>& crossword_room::players() const
+{
+    return players_;
+}
+
+/**
+ * Adds a spectator to the room.  Adding a spectator twice has no effect.
+ */
+void crossword_room::add_spectator(crossword_player *spectator)
+{
+    if (std::find(spectators_.begin(), spectators_.end(), spectator) == spectators_.end())
+        spectators_.push_back(spectator);
+    empty_since_ = 0;
+}
+
+/**
+ * Accessor for the spectators in the room.
+ */
+const std::vector<crossword_player*>& crossword_room::spectators() const
+{
+    return spectators_;
+}
+
+time_t crossword_room::empty_since() const
+{
+    return empty_since_;
+}
+
+std::string& crossword_room::spectator_batch()
+{
+    return spectator_batch_;
+}
+
+/**
+ * Holds a player's cursor for the next tick, replacing the one held before.
+ * @param player The player that moved.
+ * @param cursor The CURSOR payload.
+ */
+void crossword_room::hold_cursor(crossword_player *player, const std::string& cursor)
+{
+    for (size_t i = 0; i < held_cursors_.size(); i++)
+    {
+        if (held_cursors_[i].first == player)
+        {
+            held_cursors_[i].second = cursor;
+            return;
+        }
+    }
+    held_cursors_.push_back(std::make_pair(player, cursor));
+}
+
+bool crossword_room::has_held_cursors() const
+{
+    return !held_cursors_.empty();
+}
+
+/**
+ * Accessor for the held cursors, in the order the players first moved.
+ */
+const std::vector<std::pair<crossword_player*, std::string> >&
+crossword_room::held_cursors() const
+{
+    return held_cursors_;
+}
+
+void crossword_room::clear_held_cursors()
+{
+    held_cursors_.clear();
+}
+
+bool crossword_room::paused() const
+{
+    return paused_;
+}
+
+/**
+ * Pauses or unpauses the game.  Time spent paused does not count towards the
+ * solve time.
+ */
+void crossword_room::set_paused(bool on)
+{
+    paused_ = on;
+
+    if (paused_ && start_time_ != 0)
+    {
+        elapsed_time_ += time(NULL) - start_time_;
+        start_time_ = 0;
+    }
+    else if (!paused_ && elapsed_time_ != 0)
+        start_time_ = time(NULL);
+}
+
+bool crossword_room::start_timer()
+{
+    if (start_time_ != 0)
+        return false;
+
+    start_time_ = time(NULL);
+    return true;
+}
+
+time_t crossword_room::stop_timer()
+{
+    elapsed_time_ = time(NULL) - start_time_;
+    start_time_ = 0;
+    return elapsed_time_;
+}
+
+time_t crossword_room::start_time() const
+{
+    return start_time_;
+}
+
+time_t crossword_room::elapsed_time() const
+{
+    return elapsed_time_;
+}
+
+/**
+ * Puts the timer back the way the journal recorded it.  A timer that was
+ * running keeps its start time, so time the server was down counts towards
+ * the solve time.
+ */
+void crossword_room::restore_timer(time_t start, time_t elapsed, bool paused)
+{
+    start_time_ = start;
+    elapsed_time_ = elapsed;
+    paused_ = paused;
+}
+
+int crossword_room::journal_id() const
+{
+    return journal_id_;
+}
+
+void crossword_room::set_journal_id(int id)
+{
+    journal_id_ = id;
+}
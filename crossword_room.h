@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <utility>
+#include <ctime>
+#include "crossword_board.hpp"
+
+class crossword_player;
+
+// One game: a board and the players solving it together.  Rooms playing the
+// same puzzle share its layout, answers and clues, so an idle room costs
+// little more than its letters.
+class crossword_room
+{
+public:
+    crossword_room(const std::string& id, const crossword_board& puzzle);
+
+    const std::string& id() const;
+    crossword_board& board();
+    const crossword_board& board() const;
+
+    // Broadcasts for this room go to these players
+    void add_player(crossword_player *player);
+    void remove_player(crossword_player *player);
+    const std::vector<crossword_player*>& players() const;
+    // Spectators get the broadcasts as shared frames.  remove_player removes
+    // spectators too.
+    void add_spectator(crossword_player *spectator);
+    const std::vector<crossword_player*>& spectators() const;
+    // When the last player or spectator left, 0 while anyone is in the room.
+    // A new room counts as empty from when it was made.
+    time_t empty_since() const;
+    // Broadcasts of this loop iteration waiting to go to the spectators as
+    // one shared frame
+    std::string& spectator_batch();
+
+    // Cursor positions waiting for the next tick, only the latest one of each
+    // player is kept
+    void hold_cursor(crossword_player *player, const std::string& cursor);
+    bool has_held_cursors() const;
+    const std::vector<std::pair<crossword_player*, std::string> >& held_cursors() const;
+    void clear_held_cursors();
+
+    // Game timer
+    bool paused() const;
+    void set_paused(bool on);
+    // Starts the timer if it isn't running, returns true if it was started
+    bool start_timer();
+    // Stops the timer and returns the seconds it took to solve
+    time_t stop_timer();
+    // Timer state for the journal, start is 0 while the timer isn't running
+    time_t start_time() const;
+    time_t elapsed_time() const;
+    void restore_timer(time_t start, time_t elapsed, bool paused);
+
+    // Number of the room in the move journal, -1 if it isn't journaled
+    int journal_id() const;
+    void set_journal_id(int id);
+
+private:
+    std::string id_;
+    crossword_board board_;
+    std::vector<crossword_player*> players_;
+    std::vector<crossword_player*> spectators_;
+    std::string spectator_batch_;
+    time_t empty_since_;
+    std::vector<std::pair<crossword_player*, std::string> > held_cursors_;
+
+    time_t start_time_, elapsed_time_;
+    bool paused_;
+    int journal_id_;
+};
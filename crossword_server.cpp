@@ -1,175 +1,798 @@
 #include "crossword_server.h"
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include "crossword_protocol.h"
 
-#define BOARD_REQUEST_TYPE 1
-#define BOARD_TYPE 2
-#define UPDATE_TYPE 3
-#define CURSOR_TYPE 4
-#define WIN_TYPE 5
-#define PAUSE_TYPE 6
-#define SOLVE_WORD_TYPE 7
-#define SOLVE_LETTER_TYPE 8
+static void put_u32(std::string& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+static uint32_t get_u32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint32_t>(u[0]) << 24 | u[1] << 16 | u[2] << 8 | u[3];
+}
 
-crossword_server::crossword_server(std::ifstream& crossword_data, const std::string& inport)
-    : port(inport)
+crossword_server::crossword_server(puzzle_library& inpuzzles, const std::string& inport,
+        const send_limits& inlimits)
+    : limits(inlimits), nodelay(true), puzzles(inpuzzles), room_idle(600),
+    room_keep(86400), max_rooms(10000), next_sweep(0), cursor_tick(0), next_tick(),
+    stopping(false), journal(0), snapshots_seen(0), recorder(0), replay(0),
+    replay_spectators(0), port(inport)
 {
-    board.read(crossword_data);
 }
 crossword_server::~crossword_server() { // Remove connections
-    for (std::list<kissnet::tcp_socket*>::iterator it = connsocks.begin();
-         it != connsocks.end(); it++)
+    reap_removed();
+    for (std::list<crossword_player*>::iterator it = players.begin();
+         it != players.end(); it++)
         delete *it;
+    for (size_t i = 0; i < inbox.size(); i++)
+        delete inbox[i].player;
+    for (std::map<std::string, crossword_room*>::iterator it = rooms.begin();
+         it != rooms.end(); it++)
+        delete it->second;
+    for (std::map<int, crossword_player*>::iterator it = ghosts.begin();
+         it != ghosts.end(); it++)
+        delete it->second;
 }
 
 void crossword_server::run()
 {
     // Set up listening socket
-    servsock.listen(port, 2);
-    set.add_socket(&servsock);
-    
-    for (;;)
+    if (!port.empty())
+    {
+        servsock.listen(port, 128);
+        servsock.set_nonblocking(true);
+        set.add_socket(&servsock);
+    }
+
+    // Reused so a quiet loop iteration allocates nothing
+    std::vector<kissnet::socket_event> events;
+    while (!stopping)
     {
-        std::vector<kissnet::tcp_socket*> active = set.poll_sockets();
+        set.poll_events(events, poll_timeout());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        adopt_players();
 
-        for (size_t i = 0; i < active.size(); i++)
+        for (size_t i = 0; i < events.size(); i++)
         {
-            kissnet::tcp_socket *cursock = active[i];
-            if (*(active[i]) == servsock)
+            if (events[i].sock == &servsock)
             {
-                kissnet::tcp_socket *newsock = servsock.accept();
-                set.add_socket(newsock);
-                connsocks.push_back(newsock);
+                accept_connections();
+                continue;
             }
-            else
+
+            crossword_player *player = static_cast<crossword_player*>(events[i].data);
+            if (events[i].writable && !player->removed())
+                flush_player(player);
+            // A lagging player is throttled by leaving its input unread
+            if (events[i].readable && !player->removed() && !player->lagging())
+                read_messages(player);
+        }
+
+        if (replay && !replay->finished())
+            play_replay();
+
+        if (!cursor_rooms.empty() && std::chrono::steady_clock::now() >= next_tick)
+            flush_cursors();
+
+        // Everything queued while handling this batch goes out together
+        flush_spectators();
+        flush_players();
+        reap_removed();
+        if (!replay && room_idle > 0 && time(NULL) >= next_sweep)
+            close_idle_rooms();
+
+        if (!journal_records.empty())
+        {
+            journal->append(journal_records);
+            journal_records.clear();
+        }
+        if (journal && journal->snapshot_due(snapshots_seen))
+            save_rooms();
+        if (!recording_records.empty())
+        {
+            recorder->append(recording_records);
+            recording_records.clear();
+        }
+
+        counters.loop_usec.record(usec_since(start));
+        counters.players.store(players.size(), std::memory_order_relaxed);
+        counters.rooms.store(rooms.size(), std::memory_order_relaxed);
+    }
+}
+
+int crossword_server::poll_timeout() const
+{
+    // Wake up in time for the next tick if there are cursors to send
+    int timeout = -1;
+    if (!cursor_rooms.empty())
+    {
+        std::chrono::steady_clock::duration left =
+            next_tick - std::chrono::steady_clock::now();
+        timeout = std::max(0, static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(left).count()));
+    }
+
+    // and for the next replayed message
+    int due = replay ? replay->next_due_ms() : -1;
+    if (due >= 0 && (timeout < 0 || due < timeout))
+        timeout = due;
+
+    // and for the next sweep of idle and closed rooms
+    if (!replay && room_idle > 0 && (!rooms.empty() || !closed_rooms.empty()))
+    {
+        int sweep = std::max(0, static_cast<int>(next_sweep - time(NULL)) * 1000);
+        if (timeout < 0 || sweep < timeout)
+            timeout = sweep;
+    }
+
+    return timeout;
+}
+
+void crossword_server::stop()
+{
+    stopping = true;
+    set.interrupt();
+}
+
+void crossword_server::set_cursor_tick(int tick_ms)
+{
+    cursor_tick = tick_ms;
+}
+
+void crossword_server::set_nodelay(bool innodelay)
+{
+    nodelay = innodelay;
+}
+
+void crossword_server::set_room_limits(int idle_seconds, size_t inmax_rooms,
+        int keep_seconds)
+{
+    room_idle = idle_seconds;
+    max_rooms = inmax_rooms;
+    room_keep = keep_seconds;
+}
+
+const server_stats& crossword_server::stats() const
+{
+    return counters;
+}
+
+void crossword_server::set_journal(move_journal *injournal)
+{
+    journal = injournal;
+    if (journal)
+        journal->add_loop([this]() { set.interrupt(); });
+}
+
+void crossword_server::save_rooms()
+{
+    // Only the letters and timers are copied here, the journal's writer
+    // thread does the rest
+    std::vector<move_journal::room_state> states;
+    states.reserve(rooms.size());
+    for (std::map<std::string, crossword_room*>::iterator it = rooms.begin();
+            it != rooms.end(); it++)
+        move_journal::save_room(states, *it->second);
+    // Closed rooms are only in memory now, the segments that opened them go
+    // once the snapshot is written
+    for (std::map<std::string, closed_room>::iterator it = closed_rooms.begin();
+            it != closed_rooms.end(); it++)
+        states.push_back(it->second.state);
+    journal->add_snapshot(states);
+}
+
+void crossword_server::restore_rooms(std::map<std::string, crossword_room*>& recovered)
+{
+    std::map<std::string, crossword_room*>::iterator it = recovered.begin();
+    while (it != recovered.end())
+    {
+        if (owner_of(it->first) == this)
+        {
+            rooms[it->first] = it->second;
+            recovered.erase(it++);
+        }
+        else
+            ++it;
+    }
+}
+
+void crossword_server::set_recorder(game_recorder *inrecorder)
+{
+    recorder = inrecorder;
+}
+
+void crossword_server::set_replay(game_replay *inreplay, int spectators)
+{
+    replay = inreplay;
+    replay_spectators = spectators;
+}
+
+void crossword_server::play_replay()
+{
+    if (!replay->started())
+    {
+        size_t watching = 0;
+        for (std::map<std::string, crossword_room*>::iterator it = rooms.begin();
+                it != rooms.end(); it++)
+            watching += it->second->players().size() + it->second->spectators().size();
+        if (watching < static_cast<size_t>(replay_spectators))
+            return;
+
+        std::cout << "Replaying " << replay->size() << " messages\n";
+        replay->start();
+    }
+
+    // Flat out the replay could starve the spectators, so it gets a budget
+    // per iteration and the sockets are served in between
+    const recorded_message *message;
+    for (int i = 0; i < 4096 && replay->next(message); i++)
+    {
+        crossword_player *&ghost = ghosts[message->player];
+        if (!ghost)
+            ghost = new crossword_player(new kissnet::tcp_socket(), limits);
+
+        const char *payload = message->payload.data();
+        int size = message->payload.size();
+        counters.count_in(message->type);
+        if (message->type != BOARD_REQUEST_TYPE)
+        {
+            process_message(size, message->type, payload, ghost);
+            continue;
+        }
+
+        // Ghosts only need the room, not a seat in it
+        std::string room_id = read_board_request(payload, size, ghost);
+        ghost->set_room(open_room(room_id));
+    }
+
+    if (replay->finished())
+        std::cout << "Replay finished\n";
+}
+
+void crossword_server::set_group(const std::vector<crossword_server*>& ingroup)
+{
+    group = ingroup;
+}
+
+void crossword_server::hand_off(crossword_player *player, const std::string& room_id)
+{
+    handoff h = { player, room_id, this };
+    {
+        std::lock_guard<std::mutex> guard(inbox_lock);
+        inbox.push_back(h);
+    }
+    set.interrupt();
+}
+
+void crossword_server::accept_connections()
+{
+    // The listening socket is non blocking, take everything in the backlog
+    kissnet::tcp_socket *newsock;
+    while ((newsock = servsock.accept()))
+    {
+        try
+        {
+            newsock->set_nodelay(nodelay);
+        }
+        catch (kissnet::socket_exception& e)
+        {
+            delete newsock;
+            continue;
+        }
+
+        crossword_player *player = new crossword_player(newsock, limits);
+        set.add_socket(newsock, player);
+        players.push_back(player);
+        counters.accepted++;
+    }
+}
+
+void crossword_server::read_messages(crossword_player *player)
+{
+    frame_reader& in = player->input();
+
+    // Readiness may be edge triggered so keep reading until the socket would
+    // block.  Every complete frame is dispatched before the next read, and a
+    // partial one stays buffered until the rest of it arrives.
+    try
+    {
+        for (;;)
+        {
+            int type, size;
+            const char *payload;
+            while (!player->removed() && !player->lagging() &&
+                    in.next(type, payload, size))
             {
-                try
-                {
-                    int bytes_recv;
-                    // Read the header
-                    if ((bytes_recv = cursock->recv(header, 3)) == 0)
-                    {
-                        remove(cursock);
-                    }
-                    // Read the payload
-                    else
-                    {
-                        int type = header[0];
-                        int size = header[1] * 256 + (unsigned char) header[2];
-
-                        process_message(size, type, cursock);
-                    }
-                }
-                catch(kissnet::socket_exception& e)
+                counters.count_in(type);
+                if (recorder)
                 {
-                    remove(cursock);
+                    if (player->recording_id() < 0)
+                        player->set_recording_id(recorder->new_player());
+                    recorder->add(recording_records, player->recording_id(), type,
+                            payload, size);
                 }
+                process_message(size, type, payload, player);
+            }
+
+            // A lagging player keeps its unread frames until it catches up
+            if (player->removed() || player->lagging())
+                return;
+
+            int bytes_recv = in.fill(*player->socket());
+            if (bytes_recv == 0)
+            {
+                remove(player);
+                return;
             }
+            if (bytes_recv < 0)
+                return;
+            counters.bytes_in += bytes_recv;
+        }
+    }
+    catch(kissnet::socket_exception& e)
+    {
+        remove(player);
+    }
+}
+
+crossword_server *crossword_server::owner_of(const std::string& room_id) const
+{
+    if (group.empty())
+        return const_cast<crossword_server*>(this);
+
+    return group[std::hash<std::string>()(room_id) % group.size()];
+}
+
+void crossword_server::move_player(crossword_player *player, const std::string& room_id,
+        crossword_server *owner)
+{
+    if (player->room())
+        player->room()->remove_player(player);
+    player->set_room(0);
+
+    // Treated as removed for the rest of this iteration, it is handed over
+    // once nothing here can touch it anymore
+    set.remove_socket(player->socket());
+    player->set_removed(true);
+
+    handoff h = { player, room_id, owner };
+    outbox.push_back(h);
+}
+
+void crossword_server::adopt_players()
+{
+    std::vector<handoff> arrivals;
+    {
+        std::lock_guard<std::mutex> guard(inbox_lock);
+        arrivals.swap(inbox);
+    }
+
+    for (size_t i = 0; i < arrivals.size(); i++)
+    {
+        crossword_player *player = arrivals[i].player;
+        player->set_removed(false);
+        set.add_socket(player->socket(), player);
+        players.push_back(player);
+
+        if (!join_room(player, arrivals[i].room_id))
+        {
+            remove(player);
+            continue;
+        }
+        send_board(player);
+
+        // Output queued on the old server and frames sent right after the
+        // board request came along with the player
+        if (player->pending())
+            dirtyplayers.push_back(player);
+        read_messages(player);
+    }
+}
+
+crossword_room *crossword_server::open_room(const std::string& room_id)
+{
+    std::map<std::string, crossword_room*>::iterator it = rooms.find(room_id);
+    if (it != rooms.end())
+        return it->second;
+
+    if (max_rooms > 0 && rooms.size() >= max_rooms)
+    {
+        std::cout << "Too many rooms, not opening \"" << room_id << "\"\n";
+        return 0;
+    }
+
+    const crossword_board *puzzle = puzzles.puzzle_for_room(room_id);
+    if (!puzzle)
+    {
+        std::cout << "No puzzle for room \"" << room_id << "\"\n";
+        return 0;
+    }
+
+    crossword_room *room = new crossword_room(room_id, *puzzle);
+    rooms[room_id] = room;
+    std::map<std::string, closed_room>::iterator closed = closed_rooms.find(room_id);
+    if (closed != closed_rooms.end())
+    {
+        // Back as it was closed, in the journal under its old number
+        const move_journal::room_state& state = closed->second.state;
+        crossword_board& board = room->board();
+        if (state.letters.size() == static_cast<size_t>(board.xdim() * board.ydim()))
+        {
+            for (size_t i = 0; i < state.letters.size(); i++)
+                board.set_at(i % board.xdim(), i / board.xdim(), state.letters[i]);
+        }
+        room->restore_timer(state.start_time, state.elapsed_time, state.paused);
+        room->set_journal_id(state.journal_id);
+        closed_rooms.erase(closed);
+        std::cout << "Reopened room \"" << room_id << "\"\n";
+        return room;
+    }
+    if (journal)
+        room->set_journal_id(journal->open_room(room_id));
+    std::cout << "Opened room \"" << room_id << "\"\n";
+    return room;
+}
+
+/**
+ * Closes the rooms that have been empty for room_idle seconds.  A room with
+ * no letters filled in and no timer is the same as a new one and is simply
+ * dropped, the others are kept in closed_rooms until forget_closed_rooms
+ * lets them go.
+ */
+void crossword_server::close_idle_rooms()
+{
+    time_t now = time(NULL);
+    next_sweep = now + 1;
+
+    std::map<std::string, crossword_room*>::iterator it = rooms.begin();
+    while (it != rooms.end())
+    {
+        crossword_room *room = it->second;
+        if (room->empty_since() == 0 || now - room->empty_since() < room_idle ||
+                room->has_held_cursors() || !room->spectator_batch().empty())
+        {
+            ++it;
+            continue;
+        }
+
+        if (room->board().progress().filled > 0 || room->start_time() != 0 ||
+                room->elapsed_time() != 0)
+        {
+            std::vector<move_journal::room_state> states;
+            move_journal::save_room(states, *room);
+            closed_room& closed = closed_rooms[room->id()];
+            closed.state = states.back();
+            closed.closed = now;
+            closed_order.push_back(std::make_pair(now, room->id()));
+        }
+        std::cout << "Closed idle room \"" << room->id() << "\"\n";
+        delete room;
+        rooms.erase(it++);
+    }
+    forget_closed_rooms(now);
+}
+
+/**
+ * Drops the closed rooms kept longer than room_keep seconds, and the oldest
+ * ones past max_rooms.  They leave the next snapshot, and with it the
+ * journal, so they open as new rooms after this.
+ */
+void crossword_server::forget_closed_rooms(time_t now)
+{
+    while (!closed_order.empty())
+    {
+        const std::pair<time_t, std::string>& oldest = closed_order.front();
+        std::map<std::string, closed_room>::iterator closed =
+            closed_rooms.find(oldest.second);
+        // Reopened since, or closed again later
+        if (closed == closed_rooms.end() || closed->second.closed != oldest.first)
+        {
+            closed_order.pop_front();
+            continue;
         }
+        if ((room_keep <= 0 || now - oldest.first < room_keep) &&
+                (max_rooms == 0 || closed_rooms.size() <= max_rooms))
+            break;
+
+        std::cout << "Forgot closed room \"" << oldest.second << "\"\n";
+        closed_rooms.erase(closed);
+        closed_order.pop_front();
     }
 }
 
-void crossword_server::send_board(kissnet::tcp_socket *sock)
+bool crossword_server::join_room(crossword_player *player, const std::string& room_id)
+{
+    crossword_room *room = open_room(room_id);
+    if (!room)
+        return false;
+
+    if (player->room())
+        player->room()->remove_player(player);
+    player->set_room(room);
+    if (player->spectator())
+        room->add_spectator(player);
+    else
+        room->add_player(player);
+
+    return true;
+}
+
+void crossword_server::send_board(crossword_player *player)
 {
-    std::ostringstream out;
-    board.write(out);
+    // Newer players are told which version of the board they have, so a
+    // player that rejoins after a dropped connection only needs the cells
+    // that changed while it was away
+    const crossword_board& board = player->room()->board();
+    std::string patch;
+    if (player->protocol_version() >= 5)
+    {
+        uint32_t history, version;
+        bool resync = player->resync(history, version) && history == board.history_id();
+        player->clear_resync();
 
-    std::string packet = make_packet(out.str(), BOARD_TYPE);
+        put_u32(patch, board.history_id());
+        put_u32(patch, board.version());
+        if (resync && board.changes_since(version, patch))
+        {
+            send_packet(player, make_packet(patch, BOARD_PATCH_TYPE));
+            return;
+        }
+    }
+
+    // Only the letters are encoded per join, the rest is shared by every
+    // room playing the puzzle and goes straight into the player's queue
+    bool binary = player->board_version() >= crossword_board::binary_version;
+    const std::string& snapshot = board.snapshot_puzzle(binary);
+    kissnet::shared_buffer& puzzle = puzzle_buffers[&snapshot];
+    if (puzzle.empty())
+        puzzle = kissnet::shared_buffer(snapshot);
+    std::string letters;
+    board.snapshot_letters(letters, binary);
+
+    kissnet::shared_buffer header(make_header(binary ? BINARY_BOARD_TYPE : BOARD_TYPE,
+            puzzle.size() + letters.size()));
+    kissnet::shared_buffer tail(letters);
+    const kissnet::shared_buffer *parts[] = { &header, &puzzle, &tail };
+    // A board is kilobytes that are no use until they have all arrived, so
+    // it goes out in full segments rather than as soon as possible
     try
     {
-        if (sock->send(packet) < packet.size())
-            std::cout << "Sent incomplete packet";
+        player->cork();
     }
     catch (kissnet::socket_exception& e)
     {
-        remove(sock);
+        remove(player);
+        return;
     }
+    send_packet(player, parts, 3);
+    if (!patch.empty() && !player->removed())
+        send_packet(player, make_packet(patch, BOARD_PATCH_TYPE));
 
-    //std::cout << "Sent board packet of size " << packet.size() << '\n';
+    //std::cout << "Sent board packet of size " << header.size() + puzzle.size()
+    //    + letters.size() << '\n';
 }
 
-void crossword_server::process_update(int x, int y, char ch)
+void crossword_server::process_update(crossword_room *room, int x, int y, char ch)
 {
-    if (paused)
+    char cell[3] = { static_cast<char>(x), static_cast<char>(y), ch };
+    if (x >= 0 && x < 256 && y >= 0 && y < 256)
+        process_updates(room, cell, 1);
+    else
+        std::cout << "Got a bad update message, ignoring it.\n";
+}
+
+void crossword_server::process_updates(crossword_room *room, const char *cells, int count)
+{
+    if (room->paused())
         return;
 
-    if (x >= 0 && x < board.xdim() && y >= 0 && y < board.ydim())
+    // Apply every good cell first so the peers get them in one go
+    crossword_board& board = room->board();
+    std::string applied;
+    for (int i = 0; i < count; i++)
     {
-        board.at(x, y) = ch;
+        int x = static_cast<unsigned char>(cells[i * 3]);
+        int y = static_cast<unsigned char>(cells[i * 3 + 1]);
+        char ch = cells[i * 3 + 2];
+        if (x < board.xdim() && y < board.ydim())
+        {
+            board.set_at(x, y, ch);
+            applied.append(cells + i * 3, 3);
+        }
+        else
+            std::cout << "Got a bad update message, ignoring it.\n";
+    }
+    if (applied.empty())
+        return;
 
-        std::string data;
-        data.push_back(static_cast<char>(x));
-        data.push_back(static_cast<char>(y));
-        data.push_back(ch);
-        std::string packet = make_packet(data, UPDATE_TYPE);
+    if (journal)
+        move_journal::add_updates(journal_records, room->journal_id(), applied);
+    broadcast_updates(room, applied);
+
+    if (board.won())
+    {
+        time_t elapsed_time = room->stop_timer();
 
-        broadcast_packet(packet);
+        char buffer[40];
+        sprintf(buffer, "%ld", elapsed_time);
 
-        if (board.won())
-        {
-            elapsed_time = time(NULL) - start_time;
-            start_time = 0;
+        std::cout << "THEY HAVE WON THE GAME!!!\n" <<
+            "It took them " << buffer << " seconds\n";
+
+        broadcast_packet(room, make_shared_packet(buffer, strlen(buffer), WIN_TYPE));
+        if (journal)
+            move_journal::add_timer(journal_records, *room);
+    }
 
-            char buffer[40];
-            sprintf(buffer, "%ld", elapsed_time);
+    if (room->start_timer())
+    {
+        std::cout << "The timer has begun\n";
+        if (journal)
+            move_journal::add_timer(journal_records, *room);
+    }
+}
 
-            std::cout << "THEY HAVE WON THE GAME!!!\n" <<
-                "It took them " << buffer << " seconds\n";
+void crossword_server::broadcast_updates(crossword_room *room, const std::string& cells)
+{
+    if (cells.size() == 3)
+    {
+        broadcast_packet(room, make_shared_packet(cells.data(), 3, UPDATE_TYPE));
+        return;
+    }
 
-            std::string packet = make_packet(buffer, WIN_TYPE);
-            broadcast_packet(packet);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // Peers that know batches get one frame, the others a frame per cell
+    kissnet::shared_buffer batch = make_shared_packet(cells.data(), cells.size(),
+            UPDATE_BATCH_TYPE);
+    std::vector<kissnet::shared_buffer> singles;
+    const std::vector<crossword_player*>& members = room->players();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (members[i]->removed())
+            continue;
+        if (members[i]->protocol_version() >= 3)
+        {
+            send_packet(members[i], batch);
+            continue;
         }
 
-        if (start_time == 0)
+        if (singles.empty())
         {
-            start_time = time(NULL);
-            std::cout << "The timer has begun\n";
+            for (size_t j = 0; j < cells.size(); j += 3)
+                singles.push_back(make_shared_packet(cells.data() + j, 3, UPDATE_TYPE));
         }
+        for (size_t j = 0; j < singles.size() && !members[i]->removed(); j++)
+            send_packet(members[i], singles[j]);
     }
-    else
-        std::cout << "Got a bad update message, ignoring it.\n";
+    send_spectators(room, batch.data(), batch.size());
+    counters.fanout_usec.record(usec_since(start));
 }
 
-void crossword_server::process_cursor(int x, int y, int d, kissnet::tcp_socket *sender)
+void crossword_server::process_cursor(crossword_room *room, int x, int y, int d,
+        crossword_player *sender)
 {
+    const crossword_board& board = room->board();
     if (x >= 0 && x < board.xdim() && y >= 0 && y < board.ydim())
     {
         std::string data;
         data.push_back(static_cast<char>(x));
         data.push_back(static_cast<char>(y));
         data.push_back(static_cast<char>(d));
-        std::string packet = make_packet(data, CURSOR_TYPE);
 
-        broadcast_packet(packet, sender);
+        if (cursor_tick > 0)
+        {
+            // The first cursor held since the last tick starts the next one
+            if (cursor_rooms.empty())
+                next_tick = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(cursor_tick);
+            if (!room->has_held_cursors())
+                cursor_rooms.push_back(room);
+            room->hold_cursor(sender, data);
+            return;
+        }
+
+        broadcast_packet(room, make_shared_packet(data.data(), data.size(), CURSOR_TYPE),
+                sender);
     }
     else
         std::cout << "Got a bad cursor message, ignoring it.\n";
 }
 
-void crossword_server::process_pause(char on)
+void crossword_server::flush_cursors()
+{
+    // Reused for every member so a tick allocates next to nothing
+    std::string all, packet;
+    for (size_t i = 0; i < cursor_rooms.size(); i++)
+    {
+        crossword_room *room = cursor_rooms[i];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const std::vector<std::pair<crossword_player*, std::string> >& held =
+            room->held_cursors();
+
+        all.clear();
+        for (size_t k = 0; k < held.size(); k++)
+            all.append(held[k].second);
+        kissnet::shared_buffer shared;
+
+        // Everyone gets the cursors of the others, in one frame if they know
+        // batches.  Members that didn't move share one frame with all of them.
+        const std::vector<crossword_player*>& members = room->players();
+        for (size_t j = 0; j < members.size(); j++)
+        {
+            crossword_player *member = members[j];
+            if (member->removed())
+                continue;
+
+            if (member->protocol_version() < 4)
+            {
+                for (size_t k = 0; k < held.size() && !member->removed(); k++)
+                {
+                    if (held[k].first != member)
+                        send_packet(member, make_packet(held[k].second, CURSOR_TYPE),
+                                held[k].first);
+                }
+                continue;
+            }
+
+            bool moved = false;
+            for (size_t k = 0; k < held.size() && !moved; k++)
+                moved = held[k].first == member;
+            if (!moved)
+            {
+                if (shared.empty())
+                    shared = make_shared_packet(all.data(), all.size(), CURSOR_BATCH_TYPE);
+                send_packet(member, shared);
+                continue;
+            }
+            if (held.size() == 1)
+                continue;
+
+            packet = make_header(CURSOR_BATCH_TYPE, all.size() - 3);
+            for (size_t k = 0; k < held.size(); k++)
+            {
+                if (held[k].first != member)
+                    packet.append(held[k].second);
+            }
+            send_packet(member, packet);
+        }
+
+        if (!room->spectators().empty())
+        {
+            packet = make_header(CURSOR_BATCH_TYPE, all.size());
+            packet.append(all);
+            send_spectators(room, packet.data(), packet.size());
+        }
+
+        room->clear_held_cursors();
+        counters.fanout_usec.record(usec_since(start));
+    }
+    cursor_rooms.clear();
+}
+
+void crossword_server::process_pause(crossword_room *room, char on)
 {
-    paused = on;
-    if (paused)
+    room->set_paused(on);
+    if (room->paused())
         std::cout << "Timer paused\n";
     else
         std::cout << "Timer unpaused\n";
-
-    if (paused && start_time != 0)
-    {
-        elapsed_time += time(NULL) - start_time;
-        start_time = 0;
-    }
-    else if (!paused && elapsed_time != 0)
-        start_time = time(NULL);
+    if (journal)
+        move_journal::add_timer(journal_records, *room);
 
     std::string data;
     data.push_back(on);
-    std::string packet = make_packet(data, PAUSE_TYPE);
-
-    broadcast_packet(packet);
+    broadcast_packet(room, make_shared_packet(data.data(), data.size(), PAUSE_TYPE));
 }
 
-void crossword_server::process_solve_word(int clue, int dir)
+void crossword_server::process_solve_word(crossword_room *room, int clue, int dir)
 {
     if (dir != crossword_board::across_dir && dir != crossword_board::down_dir)
     {
@@ -178,89 +801,303 @@ void crossword_server::process_solve_word(int clue, int dir)
     }
     //std::cout << "Solving clue " << clue << " direction " << dir << '\n';
 
-    // Get the start of the clue
-    int x, y;
-    board.start_of_clue(clue, x, y);
-
-    // Set the direction
-    int xvel = 0, yvel = 0;
-    if (dir == crossword_board::across_dir)
-        xvel = 1;
-    else
-        yvel = 1;
-
+    const crossword_board& board = room->board();
 
-    // Now loop until a wall or end of board
-    for (; x < board.xdim() && y < board.ydim(); x += xvel, y += yvel)
+    int id = board.word_of_clue(dir, clue);
+    if (id < 0)
     {
-        // If we've hit a wall, we're done
-        if (board.layout_at(x, y) == crossword_board::wall_char)
-            break;
+        std::cout << "Got solve word for a clue that doesn't exist, ignoring\n";
+        return;
+    }
 
-        process_solve_letter(x, y);
+    // The whole word goes out as one batch
+    const crossword_word& word = board.word(id);
+    int xvel = dir == crossword_board::across_dir ? 1 : 0;
+    int yvel = dir == crossword_board::down_dir ? 1 : 0;
+    std::string cells;
+    for (int i = 0; i < word.length; i++)
+    {
+        int x = word.x + i * xvel, y = word.y + i * yvel;
+        cells.push_back(static_cast<char>(x));
+        cells.push_back(static_cast<char>(y));
+        cells.push_back(board.answer_at(x, y));
     }
+    process_updates(room, cells.data(), word.length);
 }
 
-void crossword_server::process_solve_letter(int x, int y)
+void crossword_server::process_solve_letter(crossword_room *room, int x, int y)
 {
     //std::cout << "Solving letter at (" << x << ',' << y << ")\n";
 
+    const crossword_board& board = room->board();
     if (x >= 0 && x < board.xdim() && y >= 0 && y < board.ydim())
-        process_update(x, y, board.answer_at(x, y));
+        process_update(room, x, y, board.answer_at(x, y));
     else
         std::cout << "Got a bad solve letter message, ignoring it\n";
 }
 
+std::string crossword_server::make_header(int type, size_t size)
+{
+    std::string header;
+    if (size <= 0xffff)
+    {
+        header.push_back(static_cast<char>(type));
+        header.push_back(static_cast<char>(size >> 8));
+        header.push_back(static_cast<char>(size & 0xff));
+    }
+    else
+    {
+        header.push_back(static_cast<char>(type | EXTENDED_FLAG));
+        for (int shift = 24; shift >= 0; shift -= 8)
+            header.push_back(static_cast<char>((size >> shift) & 0xff));
+    }
+    return header;
+}
+
 std::string crossword_server::make_packet(const std::string& data, int type)
 {
-    std::string packet;
-    packet.push_back(static_cast<unsigned char>(type));
-    packet.push_back(static_cast<unsigned char>(data.size() / 256));
-    packet.push_back(static_cast<unsigned char>(data.size() % 256));
+    std::string packet = make_header(type, data.size());
     packet.append(data);
+    return packet;
+}
 
-    if (packet.size() > 60000)
-        std::cout << "NOT sending a packet with size larger than 60000!\n";
+kissnet::shared_buffer crossword_server::make_shared_packet(const char *data, size_t size,
+        int type)
+{
+    // Header and payload go straight into the one allocation
+    char header[EXTENDED_HEADER_SIZE];
+    size_t header_size = HEADER_SIZE;
+    if (size <= 0xffff)
+    {
+        header[0] = static_cast<char>(type);
+        header[1] = static_cast<char>(size >> 8);
+        header[2] = static_cast<char>(size & 0xff);
+    }
     else
-        return packet;
+    {
+        header_size = EXTENDED_HEADER_SIZE;
+        header[0] = static_cast<char>(type | EXTENDED_FLAG);
+        for (int i = 0; i < 4; i++)
+            header[1 + i] = static_cast<char>((size >> (24 - i * 8)) & 0xff);
+    }
 
-    return "";
+    kissnet::shared_buffer packet(header_size + size);
+    memcpy(packet.fill(), header, header_size);
+    memcpy(packet.fill() + header_size, data, size);
+    return packet;
 }
 
-void crossword_server::broadcast_packet(std::string packet, kissnet::tcp_socket *sender)
+void crossword_server::broadcast_packet(crossword_room *room,
+        const kissnet::shared_buffer& packet, crossword_player *sender)
 {
-    for (std::list<kissnet::tcp_socket*>::iterator it = connsocks.begin();
-         it != connsocks.end(); it++)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::vector<crossword_player*>& members = room->players();
+    for (size_t i = 0; i < members.size(); i++)
     {
-        if (*it != sender)
+        if (members[i] != sender && !members[i]->removed())
         {
             //std::cout << "::Broadcast an update message!\n";
-            try
-            {
-            (*it)->send(packet);
-            }
-            catch (kissnet::socket_exception &e)
+            send_packet(members[i], packet, sender);
+        }
+    }
+    send_spectators(room, packet.data(), packet.size());
+    counters.fanout_usec.record(usec_since(start));
+}
+
+void crossword_server::send_spectators(crossword_room *room, const char *packet,
+        size_t size)
+{
+    const std::vector<crossword_player*>& spectators = room->spectators();
+    if (spectators.empty())
+        return;
+
+    std::string& batch = room->spectator_batch();
+    if (batch.empty())
+        spectator_rooms.push_back(room);
+    batch.append(packet, size);
+    counters.count_out(static_cast<unsigned char>(packet[0]) & ~EXTENDED_FLAG,
+            size, spectators.size());
+}
+
+void crossword_server::flush_spectators()
+{
+    for (size_t i = 0; i < spectator_rooms.size(); i++)
+    {
+        crossword_room *room = spectator_rooms[i];
+        std::string& batch = room->spectator_batch();
+        kissnet::shared_buffer frame(batch);
+        batch.clear();
+
+        // Already counted as the packets went into the batch
+        const std::vector<crossword_player*>& spectators = room->spectators();
+        for (size_t j = 0; j < spectators.size(); j++)
+        {
+            if (!spectators[j]->removed())
             {
-                remove(*it);
+                begin_send(spectators[j]);
+                end_send(spectators[j], spectators[j]->send(frame));
             }
         }
     }
+    spectator_rooms.clear();
+}
+
+void crossword_server::send_packet(crossword_player *player, const std::string& packet,
+        const crossword_player *from)
+{
+    if (begin_send(player, packet.data(), packet.size()))
+        end_send(player, player->send(packet, from));
+}
+
+void crossword_server::send_packet(crossword_player *player,
+        const kissnet::shared_buffer& packet, const crossword_player *from)
+{
+    if (begin_send(player, packet.data(), packet.size()))
+        end_send(player, player->send(packet, from));
+}
+
+void crossword_server::send_packet(crossword_player *player,
+        const kissnet::shared_buffer * const *parts, int count)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++)
+        bytes += parts[i]->size();
+    if (begin_send(player, parts[0]->data(), bytes))
+        end_send(player, player->send(parts, count));
 }
 
-void crossword_server::process_message(int size, int type, kissnet::tcp_socket *sender)
+bool crossword_server::begin_send(crossword_player *player, const char *packet,
+        size_t bytes)
+{
+    // Old clients can't read a size over 65535
+    if (bytes > 0 && (packet[0] & EXTENDED_FLAG) && player->protocol_version() < 2)
+    {
+        std::cout << "NOT sending a packet with size larger than 65535 to an "
+            "old client!\n";
+        return false;
+    }
+
+    counters.count_out(bytes == 0 ? 0 :
+            static_cast<unsigned char>(packet[0]) & ~EXTENDED_FLAG, bytes);
+    begin_send(player);
+    return true;
+}
+
+void crossword_server::begin_send(crossword_player *player)
+{
+    // Players with nothing queued yet get flushed at the end of the iteration,
+    // the others are already waiting on their socket
+    if (!player->pending())
+        dirtyplayers.push_back(player);
+}
+
+void crossword_server::end_send(crossword_player *player, bool queued)
+{
+    if (!queued)
+    {
+        std::cout << "Dropping a player that fell too far behind\n";
+        counters.dropped++;
+        remove(player);
+    }
+}
+
+void crossword_server::flush_player(crossword_player *player)
+{
+    bool was_lagging = player->lagging();
+    try
+    {
+        unsigned long calls = 0;
+        counters.bytes_out += player->flush(&calls);
+        counters.send_calls += calls;
+    }
+    catch (kissnet::socket_exception& e)
+    {
+        remove(player);
+        return;
+    }
+    counters.queue_bytes.record(player->queued());
+    set.want_write(player->socket(), player->pending());
+
+    // Input was left unread while the player was lagging, pick it up now
+    if (was_lagging && !player->lagging())
+        read_messages(player);
+}
+
+void crossword_server::flush_players()
+{
+    // Flushing can read messages that queue more packets, so the list may
+    // grow while we walk it
+    for (size_t i = 0; i < dirtyplayers.size(); i++)
+    {
+        if (!dirtyplayers[i]->removed())
+            flush_player(dirtyplayers[i]);
+    }
+    dirtyplayers.clear();
+}
+
+std::string crossword_server::read_board_request(const char *data, int size,
+        crossword_player *sender)
+{
+    // The room id may be followed by the versions the sender speaks
+    std::string room_id(data, size);
+    std::string::size_type nul = room_id.find('\0');
+    if (nul != std::string::npos)
+    {
+        if (nul + 1 < room_id.size())
+            sender->set_board_version(static_cast<unsigned char>(room_id[nul + 1]));
+        if (nul + 2 < room_id.size())
+            sender->set_protocol_version(static_cast<unsigned char>(room_id[nul + 2]));
+        if (nul + 3 < room_id.size() && sender->protocol_version() >= 4 &&
+                (room_id[nul + 3] & SPECTATOR_FLAG))
+            sender->set_spectator();
+        sender->clear_resync();
+        if (nul + 11 < room_id.size() && sender->protocol_version() >= 5 &&
+                (room_id[nul + 3] & RESYNC_FLAG))
+            sender->set_resync(get_u32(&room_id[nul + 4]), get_u32(&room_id[nul + 8]));
+        room_id.erase(nul);
+    }
+    return room_id;
+}
+
+void crossword_server::process_message(int size, int type, const char *data, crossword_player *sender)
 {
     try
     {
-        // Nothing
+        // The payload names the room to join, empty for the default room
         if (type == BOARD_REQUEST_TYPE)
         {
             //std::cout << "Recieved a board request message\n";
-            if (size != 0)
-                std::cout << "Got a board request message with a nonzero payload "
-                    "size!\n";
+            std::string room_id = read_board_request(data, size, sender);
+            crossword_server *owner = owner_of(room_id);
+            if (owner != this)
+            {
+                move_player(sender, room_id, owner);
+                return;
+            }
+            if (!join_room(sender, room_id))
+            {
+                remove(sender);
+                return;
+            }
             send_board(sender);
+            return;
+        }
+
+        crossword_room *room = sender->room();
+        if (!room)
+        {
+            std::cout << "Got a message of type " << type << " before a board "
+                "request, ignoring it\n";
+            return;
+        }
+        if (sender->spectator())
+        {
+            std::cout << "Got a message of type " << type << " from a spectator, "
+                "ignoring it\n";
+            return;
         }
-        else if (type == BOARD_TYPE)
+
+        if (type == BOARD_TYPE)
         {
             std::cout << "Recieved a board message, shouldn't have recieved this. "
                 "I'm going to ignore it!!!\n";
@@ -270,8 +1107,10 @@ void crossword_server::process_message(int size, int type, kissnet::tcp_socket *
             //std::cout << "Got an update message!\n";
             if (size != 3)
                 std::cout << "The update message is the wrong size!\n";
-            // Retrieve the payload
-            sender->recv(data, size);
+            // A short message is ignored, reading on would run into the next
+            // message or past the end of the input
+            if (size < 3)
+                return;
 
             int x = static_cast<unsigned char>(data[0]);
             int y = static_cast<unsigned char>(data[1]);
@@ -279,55 +1118,60 @@ void crossword_server::process_message(int size, int type, kissnet::tcp_socket *
 
             //std::cout << "X: " << x << " Y: " << y << " Char: \'" << ch << "\'\n";
 
-            process_update(x, y, ch);
+            process_update(room, x, y, ch);
+        }
+        else if (type == UPDATE_BATCH_TYPE)
+        {
+            // Paste style entry of many letters at once
+            if (size % 3 != 0)
+                std::cout << "The update batch message is the wrong size!\n";
+            process_updates(room, data, size / 3);
         }
         else if (type == CURSOR_TYPE)
         {
             if (size != 3)
                 std::cout << "The cursor message is the wrong size!\n";
-            // Retrieve the payload
-            sender->recv(data, size);
+            if (size < 3)
+                return;
             //std::cout << "Got a cursor position message\n";
             int x = static_cast<unsigned char>(data[0]);
             int y = static_cast<unsigned char>(data[1]);
             int dir = static_cast<unsigned char>(data[2]);
             //std::cout << "X: " << x << " Y: " << y << " Dir: " << dir << '\n';
-            process_cursor(x, y, dir, sender);
+            process_cursor(room, x, y, dir, sender);
         }
         else if (type == PAUSE_TYPE)
         {
             if (size != 1)
                 std::cout << "The pause message is the wrong size!\n";
-            // Retrieve the payload
-            sender->recv(data, size);
+            if (size < 1)
+                return;
             std::cout << "Someone wants to pause the game\n";
-            process_pause(data[0]);
+            process_pause(room, data[0]);
         }
         else if (type == SOLVE_WORD_TYPE)
         {
             // TODO
             if (size != 2)
                 std::cout << "The solve_word message is the wrong size!\n";
-            // Retrieve the payload
-            sender->recv(data, size);
+            if (size < 2)
+                return;
             int clue = data[0];
             int dir  = data[1];
-            process_solve_word(clue, dir);
+            process_solve_word(room, clue, dir);
         }
         else if (type == SOLVE_LETTER_TYPE)
         {
             if (size != 2)
                 std::cout << "The solve_letter message is the wrong size!\n";
-            // Retrieve the payload
-            sender->recv(data, size);
+            if (size < 2)
+                return;
             int x = data[0];
             int y = data[1];
-            process_solve_letter(x, y);
+            process_solve_letter(room, x, y);
         }
         else
         {
-            // Retrieve the payload
-            sender->recv(data, size);
             // Print out error message
             std::cout << "Got a message of unknown type: " << type <<
                 "\nThe data that goes with it: ";
@@ -342,11 +1186,123 @@ void crossword_server::process_message(int size, int type, kissnet::tcp_socket *
     }
 }
 
-void crossword_server::remove(kissnet::tcp_socket *sock)
+void crossword_server::remove(crossword_player *player)
 {
+    if (player->removed())
+        return;
+
     std::cout << "Someone disconnected from the server\n";
+    counters.disconnects++;
+
+    if (player->room())
+        player->room()->remove_player(player);
 
-    delete sock;
-    set.remove_socket(sock);
-    connsocks.remove(sock);
+    // Deleting is deferred until the end of the loop iteration, the player may
+    // still be referenced by the event list or a broadcast in progress
+    set.remove_socket(player->socket());
+    player->set_removed(true);
+    deadplayers.push_back(player);
+}
+
+void crossword_server::reap_removed()
+{
+    for (size_t i = 0; i < deadplayers.size(); i++)
+    {
+        players.remove(deadplayers[i]);
+        delete deadplayers[i];
+    }
+    deadplayers.clear();
+
+    for (size_t i = 0; i < outbox.size(); i++)
+    {
+        players.remove(outbox[i].player);
+        outbox[i].owner->hand_off(outbox[i].player, outbox[i].room_id);
+    }
+    outbox.clear();
+}
+
+// -----------------------------------------------------------------------------
+// server_pool
+// -----------------------------------------------------------------------------
+server_pool::server_pool(puzzle_library& puzzles, const std::string& port,
+        const send_limits& limits, int threads)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 0; i < threads; i++)
+        servers.push_back(new crossword_server(puzzles, i == 0 ? port : "", limits));
+    for (int i = 0; i < threads; i++)
+        servers[i]->set_group(servers);
+}
+
+server_pool::~server_pool()
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        delete servers[i];
+}
+
+int server_pool::size() const
+{
+    return servers.size();
+}
+
+void server_pool::set_cursor_tick(int tick_ms)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->set_cursor_tick(tick_ms);
+}
+
+void server_pool::set_room_limits(int idle_seconds, size_t max_rooms, int keep_seconds)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->set_room_limits(idle_seconds, max_rooms, keep_seconds);
+}
+
+void server_pool::set_nodelay(bool nodelay)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->set_nodelay(nodelay);
+}
+
+void server_pool::collect_stats(stats_snapshot& snapshot) const
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        snapshot.add(servers[i]->stats());
+}
+
+void server_pool::set_journal(move_journal *journal)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->set_journal(journal);
+}
+
+void server_pool::restore_rooms(std::map<std::string, crossword_room*>& recovered)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->restore_rooms(recovered);
+}
+
+void server_pool::set_recorder(game_recorder *recorder)
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->set_recorder(recorder);
+}
+
+void server_pool::run()
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < servers.size(); i++)
+        threads.push_back(std::thread(&crossword_server::run, servers[i]));
+
+    servers[0]->run();
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+void server_pool::stop()
+{
+    for (size_t i = 0; i < servers.size(); i++)
+        servers[i]->stop();
 }
@@ -1,48 +1,240 @@
 #pragma once
-#include <fstream>
 #include <list>
-#include <ctime>
+#include <deque>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include "kissnet.h"
 #include "crossword_board.hpp"
+#include "crossword_player.h"
+#include "crossword_room.h"
+#include "puzzle_library.h"
+#include "server_stats.h"
+#include "move_journal.h"
+#include "game_recording.h"
 
 #define CROSSWORD_PORT "3333"
 
+// One event loop serving a set of rooms.  A server with an empty port does not
+// accept connections and only serves players handed to it by a server_pool.
 class crossword_server
 {
 public:
-    crossword_server(std::ifstream& crossword_data, const std::string& port = CROSSWORD_PORT);
+    crossword_server(puzzle_library& puzzles, const std::string& port = CROSSWORD_PORT,
+            const send_limits& limits = send_limits());
     ~crossword_server();
 
     void start();
     void run();
+    // Makes run return, may be called from any thread
+    void stop();
 
+    // Spreads rooms over the servers in group by a hash of the room id.  Every
+    // server in the group must be given the same list.
+    void set_group(const std::vector<crossword_server*>& group);
+    // Queues a player that asked for a room owned by this server, may be
+    // called from any thread
+    void hand_off(crossword_player *player, const std::string& room_id);
+    // With a tick cursors are held and sent at most once per tick_ms, only
+    // the latest position of each player.  0 sends every cursor right away.
+    void set_cursor_tick(int tick_ms);
+    // Counters for this server's loop, may be read from any thread
+    const server_stats& stats() const;
+    // Journals the moves of every room.  Call before run.
+    void set_journal(move_journal *journal);
+    // Takes the rooms owned by this server out of recovered.  Call before
+    // run, after set_group.
+    void restore_rooms(std::map<std::string, crossword_room*>& recovered);
+    // Records every message the players send.  Call before run.
+    void set_recorder(game_recorder *recorder);
+    // Plays a recording into its rooms for whoever joins them to watch,
+    // starting once that many spectators are in.  The server must run alone.
+    // Call before run.
+    void set_replay(game_replay *replay, int spectators = 0);
+    // Sets TCP_NODELAY on accepted sockets so keystrokes go out right away.
+    // On by default.  Boards are corked either way.
+    void set_nodelay(bool nodelay);
+    // Rooms nobody has been in for idle_seconds are closed.  The letters and
+    // timer of a played room are kept for keep_seconds, and the room reopens
+    // as it was.  No more than max_rooms rooms are open, new rooms past that
+    // are refused, and no more than max_rooms closed ones are kept, the
+    // oldest are forgotten first.  0 turns any of them off.  Rooms aren't
+    // closed while replaying.
+    void set_room_limits(int idle_seconds, size_t max_rooms, int keep_seconds = 86400);
 
 private:
     // Helper functions
-    void process_message(int size, int type, kissnet::tcp_socket *sender);
-    void send_board(kissnet::tcp_socket *user);
-    void process_update(int x, int y, char ch);
-    void process_cursor(int x, int y, int d, kissnet::tcp_socket *sender);
-    void process_pause(char on);
-    void process_solve_word(int clue, int dir);
-    void process_solve_letter(int x, int y);
+    void accept_connections();
+    void read_messages(crossword_player *player);
+    void process_message(int size, int type, const char *data, crossword_player *sender);
+    // Returns the room id of a board request and notes the sender's versions
+    std::string read_board_request(const char *data, int size, crossword_player *sender);
+    crossword_room *open_room(const std::string& room_id);
+    void close_idle_rooms();
+    void forget_closed_rooms(time_t now);
+    bool join_room(crossword_player *player, const std::string& room_id);
+    void send_board(crossword_player *user);
+    void process_update(crossword_room *room, int x, int y, char ch);
+    void process_updates(crossword_room *room, const char *cells, int count);
+    void broadcast_updates(crossword_room *room, const std::string& cells);
+    void process_cursor(crossword_room *room, int x, int y, int d, crossword_player *sender);
+    void flush_cursors();
+    void process_pause(crossword_room *room, char on);
+    void process_solve_word(crossword_room *room, int clue, int dir);
+    void process_solve_letter(crossword_room *room, int x, int y);
+    // Picks the extended header for payloads over 65535 bytes
+    std::string make_header(int type, size_t size);
+    // A packet for one player
     std::string make_packet(const std::string& data, int type);
-    void broadcast_packet(std::string packet, kissnet::tcp_socket *sender = 0);
+    // A packet to broadcast, encoded once and shared by every player
+    kissnet::shared_buffer make_shared_packet(const char *data, size_t size, int type);
+    void broadcast_packet(crossword_room *room, const kissnet::shared_buffer& packet,
+            crossword_player *sender = 0);
+    // from is the player a CURSOR packet is about
+    void send_packet(crossword_player *player, const std::string& packet,
+            const crossword_player *from = 0);
+    void send_packet(crossword_player *player, const kissnet::shared_buffer& packet,
+            const crossword_player *from = 0);
+    void send_packet(crossword_player *player, const kissnet::shared_buffer * const *parts,
+            int count);
+    // Checks and counts a packet and marks the player for flushing, false if
+    // the player can't take it
+    bool begin_send(crossword_player *player, const char *packet, size_t bytes);
+    void begin_send(crossword_player *player);
+    // Drops the player if the packet didn't fit its queue
+    void end_send(crossword_player *player, bool queued);
+    // Spectators get everything broadcast in a room during one loop
+    // iteration as one buffer they all share
+    void send_spectators(crossword_room *room, const char *packet, size_t size);
+    void flush_spectators();
+    void flush_player(crossword_player *player);
+    void flush_players();
 
-    void remove(kissnet::tcp_socket *sock);
+    crossword_server *owner_of(const std::string& room_id) const;
+    void move_player(crossword_player *player, const std::string& room_id,
+            crossword_server *owner);
+    void adopt_players();
+
+    void remove(crossword_player *player);
+    void reap_removed();
+    // Hands a copy of every room to the journal's snapshot
+    void save_rooms();
+    // Feeds the replay's due messages through process_message
+    void play_replay();
+    // How long poll may wait, -1 for as long as it likes
+    int poll_timeout() const;
+
+    // A player on its way from one server to another
+    struct handoff
+    {
+        crossword_player *player;
+        std::string room_id;
+        crossword_server *owner;
+    };
 
 
     // Member Variables
     kissnet::tcp_socket servsock;
-    std::list<kissnet::tcp_socket*> connsocks;
+    std::list<crossword_player*> players;
+    // Players that have been removed but not yet deleted
+    std::vector<crossword_player*> deadplayers;
+    // Players that had packets queued during this loop iteration
+    std::vector<crossword_player*> dirtyplayers;
     kissnet::socket_set set;
+    send_limits limits;
+    bool nodelay;
+
+    puzzle_library& puzzles;
+    std::map<std::string, crossword_room*> rooms;
+    // Rooms closed after being idle, as they were when closed
+    struct closed_room
+    {
+        move_journal::room_state state;
+        time_t closed;
+    };
+    std::map<std::string, closed_room> closed_rooms;
+    // Closed room ids, oldest first.  Rooms reopened or closed again are left
+    // in here until they come up.
+    std::deque<std::pair<time_t, std::string> > closed_order;
+    int room_idle;
+    int room_keep;
+    size_t max_rooms;
+    time_t next_sweep;
+    // The encoded puzzles of board packets, keyed by the board's snapshot
+    std::map<const std::string*, kissnet::shared_buffer> puzzle_buffers;
+
+    // Cursor tick, 0 when cursors are sent right away
+    int cursor_tick;
+    std::chrono::steady_clock::time_point next_tick;
+    // Rooms holding cursors for the next tick
+    std::vector<crossword_room*> cursor_rooms;
+    // Rooms with broadcasts for their spectators in this loop iteration
+    std::vector<crossword_room*> spectator_rooms;
 
-    crossword_board board;
+    // Servers sharing the rooms, empty when running alone
+    std::vector<crossword_server*> group;
+    // Players leaving for another server at the end of this loop iteration
+    std::vector<handoff> outbox;
+    // Players handed over by other servers, guarded by inbox_lock.  This and
+    // the puzzle library are the only state shared between threads.
+    std::mutex inbox_lock;
+    std::vector<handoff> inbox;
+    std::atomic<bool> stopping;
+    server_stats counters;
+
+    // Move journal, NULL if not journaling, and the records of this loop
+    // iteration waiting to be handed to it
+    move_journal *journal;
+    std::string journal_records;
+    // Snapshots this loop has handed its rooms to
+    int snapshots_seen;
+
+    // Game recording, NULL if not recording, and the messages of this loop
+    // iteration waiting to be written
+    game_recorder *recorder;
+    std::string recording_records;
+
+    // Replay, NULL if not replaying, with a stand in for every recorded
+    // player.  They send the recorded messages but aren't in any room so
+    // nothing is ever sent to them.
+    game_replay *replay;
+    int replay_spectators;
+    std::map<int, crossword_player*> ghosts;
 
     std::string port;
-    time_t start_time, elapsed_time;
-    bool paused;
+};
+
+// Runs one crossword_server per thread.  The first one accepts connections
+// and every player is handed to the server owning its room when it sends a
+// board request, so the loops share no state on the per keystroke path.
+class server_pool
+{
+public:
+    // threads <= 0 uses one thread per core
+    server_pool(puzzle_library& puzzles, const std::string& port,
+            const send_limits& limits, int threads);
+    ~server_pool();
+
+    int size() const;
+    void set_cursor_tick(int tick_ms);
+    // Adds up the counters of every loop, may be called from any thread
+    void collect_stats(stats_snapshot& snapshot) const;
+    // See crossword_server
+    void set_journal(move_journal *journal);
+    void restore_rooms(std::map<std::string, crossword_room*>& recovered);
+    void set_recorder(game_recorder *recorder);
+    void set_nodelay(bool nodelay);
+    void set_room_limits(int idle_seconds, size_t max_rooms, int keep_seconds);
+    // Blocks until stop is called
+    void run();
+    void stop();
+
+private:
+    // Not copyable
+    server_pool(const server_pool&);
+    server_pool& operator=(const server_pool&);
 
-    char header[3];
-    char data[256*256];
+    std::vector<crossword_server*> servers;
 };
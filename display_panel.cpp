@@ -72,9 +72,9 @@ void display_panel::clear_other_cursors()
     change();
 }
 
-void display_panel::set_other_cursors(int x, int y, int dir)
+void display_panel::set_other_cursors(int x, int y, int dir, bool clear)
 {
-    update_word_coords(other_word_coords_, x, y, dir, true);
+    update_word_coords(other_word_coords_, x, y, dir, clear);
     change();
 }
 
@@ -134,6 +134,12 @@ void display_panel::update_display()
     // Update the woord coords so they draw correctly
     update_word_coords(word_coords_, xcur_, ycur_, dir_, true);
 
+    // Wrong letters for easy mode, found in one pass over the board.  Same
+    // rule as always: a letter is red if the answer is known and differs.
+    std::vector<uint64_t> mistakes;
+    if (easy_mode_)
+        board_.progress(&mistakes);
+
     // Draw each tile.
     for (int y = 0; y < ydim; y++)
     {
@@ -192,8 +198,8 @@ void display_panel::update_display()
                     wxString text;
                     text += cur;
                     // Is it the wrong letter?
-                    if (easy_mode_ && board_.answer_at(x, y) != ' ' &&
-                            board_.answer_at(x, y) != cur)
+                    int i = y * xdim + x;
+                    if (easy_mode_ && (mistakes[i / 64] >> (i % 64) & 1))
                         bitmap.SetTextForeground(red_text_color);
                     bitmap.SetFont(largefont);
                     bitmap.DrawText(text, x * x_cellsize_ + xoffset,
@@ -267,68 +273,22 @@ void display_panel::update_word_coords(std::list<wxPoint>& coords, int x, int y,
     // Clear the old set
     if (clear)
         coords.clear();
-    // Cache the dimension values
-    int xdim = board_.xdim();
-    int ydim = board_.ydim();
 
-    // First fill in some velocity things so we can use them
-    int xvel, yvel;
-    xvel = yvel = 0;
-    if (dir == crossword_board::down_dir)
-        yvel = 1;
-    else
-        xvel = 1;
+    int id = board_.word_at(x, y, dir);
+    if (id < 0)
+        return;
 
-    // Now go backwards until the start of the word
-    start_of_word(x, y, dir);
-    // Now go fowards until we hit a wall or the edge (the end of the word)
-    while (x > -1 && x < xdim && y > -1 && y < ydim)
-    {
-        // have we hit a wall?
-        if (board_.layout_at(x, y) == crossword_board::wall_char)
-            break;
-        // Add the point
-        coords.push_back(wxPoint(x, y));
-        x += xvel;
-        y += yvel;
-    }
+    const crossword_word& word = board_.word(id);
+    int xvel = (dir == crossword_board::across_dir) ? 1 : 0;
+    int yvel = (dir == crossword_board::down_dir) ? 1 : 0;
+    for (int i = 0; i < word.length; i++)
+        coords.push_back(wxPoint(word.x + i * xvel, word.y + i * yvel));
 }
 
 void display_panel::update_cluenum() const
 {
-    int x = xcur_;
-    int y = ycur_;
-    start_of_word(x, y, dir_);
-
-    cluenum_ = board_.layout_at(x, y);
-}
-
-// TODO Perhaps this is a function better suited for crossword_board
-void display_panel::start_of_word(int& x, int& y, int dir) const
-{
-    int xdim = board_.xdim();
-    int ydim = board_.ydim();
-
-    int xvel, yvel;
-    xvel = yvel = 0;
-    if (dir == crossword_board::down_dir)
-        yvel = -1;
-    else
-        xvel = -1;
-
-    while (x > -1 && x < xdim && y > -1 && y < ydim)
-    {
-        if (board_.layout_at(x, y) == crossword_board::wall_char)
-        {
-            x -= xvel;
-            y -= yvel;
-            return;
-        }
-        x += xvel;
-        y += yvel;
-    }
-    x -= xvel;
-    y -= yvel;
+    int id = board_.word_at(xcur_, ycur_, dir_);
+    cluenum_ = id < 0 ? 0 : board_.word(id).clue;
 }
 
 
@@ -381,15 +341,11 @@ void display_panel::on_key(wxKeyEvent& event)
     {
         parent_->pause();
     }
-    // Tab and Enter go to the next clue
+    // Tab and Enter go to the next clue, with shift to the previous one
     else if (code == WXK_TAB || code == WXK_RETURN)
     {
-        crossword_clue clue;
-        if (event.ShiftDown())
-            // TODO change this to going backwards
-            clue = board_.next_clue(dir_, cluenum_);
-        else
-            clue = board_.next_clue(dir_, cluenum_);
+        const crossword_clue& clue = event.ShiftDown() ?
+            board_.previous_clue(dir_, cluenum_) : board_.next_clue(dir_, cluenum_);
 
         // Set the related stuff to be the next clue
         if (clue != crossword_clue::empty_clue)
@@ -17,7 +17,9 @@ public:
     void change(bool propagate = false);
     void toggle_easy();
     void clear_other_cursors();
-    void set_other_cursors(int x, int y, int dir);
+    // Highlights another player's word, replacing the others unless clear is
+    // false
+    void set_other_cursors(int x, int y, int dir, bool clear = true);
 
     int xcur() const;
     int ycur() const;
@@ -52,7 +54,6 @@ private:
     void update_display();
     void update_word_coords(std::list<wxPoint>& coords, int x, int y, int dir,
             bool clear);
-    void start_of_word(int& x, int& y, int dir) const;
     void move_direction(bool backward = false);
     bool move_velocity(int xvel, int yvel, bool jump = false);
     void update_cluenum() const;
@@ -0,0 +1,93 @@
+#include "frame_reader.h"
+#include <cstring>
+#include "crossword_protocol.h"
+
+/// Initial buffer size, grown when a single frame needs more
+static const size_t initial_capacity = 4096;
+
+/// Creates an empty reader, the buffer is allocated on first use.
+frame_reader::frame_reader()
+: buf_(0), capacity_(0), start_(0), end_(0)
+{
+}
+
+/// Destructor
+frame_reader::~frame_reader()
+{
+    delete[] buf_;
+}
+
+/**
+ * Reads from the socket into the free end of the buffer.  Consumed bytes are
+ * dropped from the front first, and the buffer only grows when a partial
+ * frame already fills it.
+ * @param sock A non blocking socket.
+ * @return Bytes read, 0 on a closed connection, -1 if nothing was ready.
+ */
+int frame_reader::fill(kissnet::tcp_socket& sock)
+{
+    if (start_ > 0)
+    {
+        memmove(buf_, buf_ + start_, end_ - start_);
+        end_ -= start_;
+        start_ = 0;
+    }
+
+    if (end_ == capacity_)
+    {
+        size_t capacity = capacity_ ? capacity_ * 2 : initial_capacity;
+        char *buf = new char[capacity];
+        if (end_ > 0)
+            memcpy(buf, buf_, end_);
+        delete[] buf_;
+        buf_ = buf;
+        capacity_ = capacity;
+    }
+
+    int bytes = sock.recv(buf_ + end_, capacity_ - end_);
+    if (bytes > 0)
+        end_ += bytes;
+    return bytes;
+}
+
+/**
+ * Hands out the next complete frame in the buffer.
+ * @param type OUT PARAM the message type.
+ * @param payload OUT PARAM the start of the payload.
+ * @param size OUT PARAM the size of the payload.
+ * @return True if a frame was available.
+ */
+bool frame_reader::next(int& type, const char*& payload, int& size)
+{
+    size_t avail = end_ - start_;
+    if (avail < HEADER_SIZE)
+        return false;
+
+    const unsigned char *header = reinterpret_cast<unsigned char*>(buf_ + start_);
+    size_t header_size = HEADER_SIZE;
+    size_t len = header[1] << 8 | header[2];
+    if (header[0] & EXTENDED_FLAG)
+    {
+        header_size = EXTENDED_HEADER_SIZE;
+        if (avail < header_size)
+            return false;
+        len = static_cast<size_t>(header[1]) << 24 | header[2] << 16 |
+            header[3] << 8 | header[4];
+        if (len > MAX_FRAME_SIZE)
+            throw kissnet::socket_exception("Incoming frame is too large");
+    }
+    if (avail < header_size + len)
+        return false;
+
+    type = header[0] & ~EXTENDED_FLAG;
+    payload = buf_ + start_ + header_size;
+    size = len;
+    start_ += header_size + len;
+
+    return true;
+}
+
+size_t frame_reader::buffered() const
+{
+    return end_ - start_;
+}
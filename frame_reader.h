@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include "kissnet.h"
+
+// Incremental decoder for the packet stream coming from one connection.
+// Bytes are read into a buffer that is kept for the life of the connection and
+// complete frames are handed out straight from it.  A partial frame stays
+// buffered until the rest of it arrives.
+class frame_reader
+{
+public:
+    frame_reader();
+    ~frame_reader();
+
+    // Reads whatever the socket has buffered, without blocking.  Returns the
+    // number of bytes read, 0 if the peer closed the connection or -1 if there
+    // was nothing to read.  Socket errors are thrown.
+    int fill(kissnet::tcp_socket& sock);
+
+    // Gets the next complete frame, with either header size.  The payload
+    // points into the buffer and stays valid until the next call to fill.
+    // Returns false if no complete frame is buffered.  A frame bigger than
+    // MAX_FRAME_SIZE is thrown as a socket_exception.
+    bool next(int& type, const char*& payload, int& size);
+
+    // Number of bytes buffered that have not been handed out yet
+    size_t buffered() const;
+
+private:
+    // Not copyable
+    frame_reader(const frame_reader&);
+    frame_reader& operator=(const frame_reader&);
+
+    char *buf_;
+    size_t capacity_;
+    // Unconsumed bytes are [start_, end_)
+    size_t start_, end_;
+};
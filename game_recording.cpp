@@ -0,0 +1,170 @@
+#include "game_recording.h"
+#include <stdexcept>
+#include <algorithm>
+
+/// Recording files start with this
+static const char recording_magic[] = "XWRC";
+/// Bytes before the payload of every entry
+static const size_t entry_header = 11;
+
+static void put_u16(std::string& out, unsigned long value)
+{
+    out.push_back(static_cast<char>((value >> 8) & 0xff));
+    out.push_back(static_cast<char>(value & 0xff));
+}
+
+static void put_u32(std::string& out, unsigned long value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return static_cast<unsigned long>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/**
+ * Constructor.  An existing file is replaced.
+ * @param path The file to record to.
+ */
+game_recorder::game_recorder(const std::string& path)
+: start_(std::chrono::steady_clock::now()), next_player_(0), lock_(),
+    out_(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc)
+{
+    if (!out_)
+        throw std::runtime_error("Unable to create recording " + path);
+    out_.write(recording_magic, 4);
+}
+
+int game_recorder::new_player()
+{
+    return next_player_++;
+}
+
+/**
+ * Encodes a message, stamped with the time it is added.
+ * @param records The string to add the entry to.
+ * @param player The sender's number from new_player.
+ * @param type The message type.
+ * @param payload The message payload.
+ * @param size The payload size.
+ */
+void game_recorder::add(std::string& records, int player, int type,
+        const char *payload, int size) const
+{
+    unsigned long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+    put_u32(records, ms);
+    put_u16(records, player);
+    records.push_back(static_cast<char>(type));
+    put_u32(records, size);
+    records.append(payload, size);
+}
+
+void game_recorder::append(const std::string& records)
+{
+    if (records.empty())
+        return;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    out_.write(records.data(), records.size());
+    out_.flush();
+}
+
+/**
+ * Reads a recording.  A truncated last entry, as left by a server that was
+ * killed, is ignored.
+ * @param path The recording.
+ * @param speed Playback speed, 0 for as fast as possible.
+ */
+game_replay::game_replay(const std::string& path, double speed)
+: messages_(), speed_(speed), pos_(0), started_(false), start_(), finished_(false)
+{
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Unable to open recording " + path);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.compare(0, 4, recording_magic) != 0)
+        throw std::runtime_error(path + " is not a recording");
+
+    size_t pos = 4;
+    while (pos + entry_header <= data.size())
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char*>(&data[pos]);
+        size_t size = get_u32(p + 7);
+        if (pos + entry_header + size > data.size())
+            break;
+
+        recorded_message message;
+        message.time_ms = get_u32(p);
+        message.player = p[4] << 8 | p[5];
+        message.type = p[6];
+        message.payload.assign(data, pos + entry_header, size);
+        messages_.push_back(message);
+        pos += entry_header + size;
+    }
+    finished_ = messages_.empty();
+}
+
+size_t game_replay::size() const
+{
+    return messages_.size();
+}
+
+double game_replay::speed() const
+{
+    return speed_;
+}
+
+void game_replay::start()
+{
+    started_ = true;
+    start_ = std::chrono::steady_clock::now();
+}
+
+bool game_replay::started() const
+{
+    return started_;
+}
+
+bool game_replay::finished() const
+{
+    return finished_;
+}
+
+std::chrono::steady_clock::time_point game_replay::due() const
+{
+    if (speed_ <= 0)
+        return start_;
+
+    // Times are relative to the first message so a recording that began
+    // with an idle server doesn't open with a pause
+    double ms = (messages_[pos_].time_ms - messages_[0].time_ms) / speed_;
+    return start_ + std::chrono::microseconds(static_cast<long long>(ms * 1000));
+}
+
+int game_replay::next_due_ms() const
+{
+    if (!started_ || finished_)
+        return -1;
+
+    std::chrono::steady_clock::duration left = due() - std::chrono::steady_clock::now();
+    // Round up, waking early would only mean polling again
+    long long ms = (std::chrono::duration_cast<std::chrono::microseconds>(left).count()
+            + 999) / 1000;
+    return static_cast<int>(std::max(0LL, ms));
+}
+
+bool game_replay::next(const recorded_message*& message)
+{
+    if (!started_ || finished_)
+        return false;
+    if (speed_ > 0 && due() > std::chrono::steady_clock::now())
+        return false;
+
+    message = &messages_[pos_++];
+    if (pos_ == messages_.size())
+        finished_ = true;
+    return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// A recording is every message the players sent, in the order the server
+// handled them, with when it arrived and who sent it.  Played back through
+// the server it reproduces the game, cursors included, for spectators.
+//
+// The file starts with "XWRC" and then holds one entry per message:
+//   time in ms since the recording started (4 bytes) | player (2 bytes) |
+//   type (1 byte) | payload size (4 bytes) | payload
+// with big endian numbers.  Players are numbered from 0 in the order they
+// first sent something.
+
+struct recorded_message
+{
+    unsigned long time_ms;
+    int player;
+    int type;
+    std::string payload;
+};
+
+class game_recorder
+{
+public:
+    // Creates the recording, errors are thrown as runtime_error
+    explicit game_recorder(const std::string& path);
+
+    // Numbers a player the first time it sends something.  May be called
+    // from any thread.
+    int new_player();
+    // Encodes a message onto the end of records, for append
+    void add(std::string& records, int player, int type, const char *payload,
+            int size) const;
+    // Writes records to the file.  May be called from any thread.
+    void append(const std::string& records);
+
+private:
+    // Not copyable
+    game_recorder(const game_recorder&);
+    game_recorder& operator=(const game_recorder&);
+
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<int> next_player_;
+    std::mutex lock_;
+    std::ofstream out_;
+};
+
+// Reads a recording back and hands out its messages when they are due
+class game_replay
+{
+public:
+    // Reads the whole recording, errors are thrown as runtime_error.  speed
+    // is how many times faster than the original to play, 0 for as fast as
+    // possible.
+    game_replay(const std::string& path, double speed);
+
+    size_t size() const;
+    double speed() const;
+
+    // Starts the clock, messages are only due after this
+    void start();
+    bool started() const;
+    // True once every message has been handed out.  May be called from any
+    // thread.
+    bool finished() const;
+
+    // Milliseconds until the next message is due, 0 if one is due now and -1
+    // if the replay hasn't started or is finished
+    int next_due_ms() const;
+    // Gets the next message if it is due.  The message lives as long as the
+    // replay.
+    bool next(const recorded_message*& message);
+
+private:
+    // Not copyable
+    game_replay(const game_replay&);
+    game_replay& operator=(const game_replay&);
+
+    // When the message at pos_ is due
+    std::chrono::steady_clock::time_point due() const;
+
+    std::vector<recorded_message> messages_;
+    double speed_;
+    size_t pos_;
+    bool started_;
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<bool> finished_;
+};
@@ -2,6 +2,9 @@
 #include <iostream>
 #include <cstring> // for strerror
 #include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include <errno.h>
 
 #ifndef _MSC_VER
@@ -10,12 +13,26 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #else
 #include <WinSock2.h>
 #include <ws2tcpip.h>
 #endif
 
+#ifdef KISSNET_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 namespace kissnet
 {
 // -----------------------------------------------------------------------------
@@ -54,10 +71,106 @@ const char * socket_exception::what() const throw()
 }
 // -----------------------------------------------------------------------------
 
+// The count is followed by the bytes in the same allocation
+struct shared_buffer::block
+{
+    std::atomic<int> refs;
+
+    char *bytes() { return reinterpret_cast<char*>(this + 1); }
+};
+
+shared_buffer::shared_buffer()
+    : block_(NULL), size_(0)
+{
+}
+
+shared_buffer::shared_buffer(size_t size)
+    : block_(NULL), size_(size)
+{
+    if (size <= inline_size)
+        return;
+    block_ = static_cast<block*>(::operator new(sizeof(block) + size));
+    new (&block_->refs) std::atomic<int>(1);
+}
+
+shared_buffer::shared_buffer(const char *data, size_t size)
+    : block_(NULL), size_(0)
+{
+    shared_buffer buf(size);
+    if (size > 0)
+        memcpy(buf.fill(), data, size);
+    *this = buf;
+}
+
+shared_buffer::shared_buffer(const std::string& data)
+    : block_(NULL), size_(0)
+{
+    *this = shared_buffer(data.data(), data.size());
+}
+
+shared_buffer::shared_buffer(const shared_buffer& other)
+    : block_(other.block_), size_(other.size_)
+{
+    if (block_)
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+    else
+        memcpy(inline_, other.inline_, size_);
+}
+
+shared_buffer& shared_buffer::operator=(const shared_buffer& other)
+{
+    if (other.block_)
+        other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+    release();
+    block_ = other.block_;
+    size_ = other.size_;
+    if (!block_ && this != &other)
+        memcpy(inline_, other.inline_, size_);
+    return *this;
+}
+
+shared_buffer::~shared_buffer()
+{
+    release();
+}
+
+void shared_buffer::release()
+{
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        block_->refs.~atomic<int>();
+        ::operator delete(block_);
+    }
+    block_ = NULL;
+}
+
+const char *shared_buffer::data() const
+{
+    return block_ ? block_->bytes() : inline_;
+}
+
+size_t shared_buffer::size() const
+{
+    return size_;
+}
+
+bool shared_buffer::empty() const
+{
+    return size_ == 0;
+}
+
+char *shared_buffer::fill()
+{
+    return block_ ? block_->bytes() : inline_;
+}
+
+// -----------------------------------------------------------------------------
+
 tcp_socket::tcp_socket()
 {
     // Create socket
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        throw socket_exception("Unable to create socket", true);
 }
 
 tcp_socket::tcp_socket(int sock_fd)
@@ -125,19 +238,90 @@ tcp_socket * tcp_socket::accept()
 {
     int newsock;
     if ((newsock = ::accept(sock, NULL, NULL)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NULL;
         throw socket_exception("Unable to accept", true);
+    }
 
     return new tcp_socket(newsock);
 }
 
 int tcp_socket::send(const std::string& data)
+{
+    return send(data.c_str(), data.size());
+}
+
+int tcp_socket::send(const char *data, int data_len)
 {
     int bytes_sent;
     
-    if ((bytes_sent = ::send(sock, data.c_str(), data.size(), 0)) < 0)
+    if ((bytes_sent = ::send(sock, data, data_len, MSG_NOSIGNAL)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
         throw socket_exception("Unable to send", true);
+    }
+
+    return bytes_sent;
+}
+
+int tcp_socket::send(const char * const *data, const size_t *data_lens, int count)
+{
+#ifndef _MSC_VER
+    // sendmsg rather than writev so a closed peer doesn't raise SIGPIPE
+    struct iovec iov[64];
+    count = std::min(count, 64);
+    for (int i = 0; i < count; i++)
+    {
+        iov[i].iov_base = const_cast<char*>(data[i]);
+        iov[i].iov_len = data_lens[i];
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
 
+    int bytes_sent;
+    if ((bytes_sent = ::sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
+        throw socket_exception("Unable to send", true);
+    }
     return bytes_sent;
+#else
+    // One buffer at a time, stopping at the first short send
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int bytes_sent = send(data[i], data_lens[i]);
+        if (bytes_sent < 0)
+            return total > 0 ? total : -1;
+        total += bytes_sent;
+        if (bytes_sent < static_cast<int>(data_lens[i]))
+            break;
+    }
+    return total;
+#endif
+}
+
+int tcp_socket::send(const shared_buffer& data)
+{
+    return send(data.data(), data.size());
+}
+
+int tcp_socket::send(const shared_buffer *data, int count)
+{
+    const char *bufs[64];
+    size_t lens[64];
+    count = std::min(count, 64);
+    for (int i = 0; i < count; i++)
+    {
+        bufs[i] = data[i].data();
+        lens[i] = data[i].size();
+    }
+    return send(bufs, lens, count);
 }
 
 int tcp_socket::recv(char *buffer, int buffer_len)
@@ -145,11 +329,49 @@ int tcp_socket::recv(char *buffer, int buffer_len)
     int bytes_received;
 
     if ((bytes_received = ::recv(sock, buffer, buffer_len, 0)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
         throw socket_exception("Unable to recv", true);
+    }
 
     return bytes_received;
 }
 
+void tcp_socket::set_nonblocking(bool nonblocking)
+{
+#ifdef _MSC_VER
+    u_long mode = nonblocking ? 1 : 0;
+    if (::ioctlsocket(sock, FIONBIO, &mode) != 0)
+        throw socket_exception("Unable to set blocking mode", false);
+#else
+    int flags = ::fcntl(sock, F_GETFL, 0);
+    if (flags < 0)
+        throw socket_exception("Unable to get socket flags", true);
+
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (::fcntl(sock, F_SETFL, flags) < 0)
+        throw socket_exception("Unable to set blocking mode", true);
+#endif
+}
+
+void tcp_socket::set_nodelay(bool nodelay)
+{
+    int value = nodelay ? 1 : 0;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+                reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
+        throw socket_exception("Unable to set TCP_NODELAY", true);
+}
+
+void tcp_socket::set_cork(bool cork)
+{
+#ifdef TCP_CORK
+    int value = cork ? 1 : 0;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) < 0)
+        throw socket_exception("Unable to set TCP_CORK", true);
+#endif
+}
+
 int tcp_socket::getSocket() const
 {
     return sock;
@@ -163,55 +385,291 @@ bool tcp_socket::operator==(const tcp_socket &rhs) const
 // -----------------------------------------------------------------------------
 // socket_set definitions
 // -----------------------------------------------------------------------------
+#ifdef KISSNET_USE_EPOLL
+
+socket_set::socket_set()
+    : epfd(-1), wakefd(-1), nsocks(0), events(NULL), max_events(0), entries()
+{
+    if ((epfd = ::epoll_create(1)) < 0)
+        throw socket_exception("Unable to create epoll instance", true);
+
+    if ((wakefd = ::eventfd(0, EFD_NONBLOCK)) < 0)
+    {
+        ::close(epfd);
+        throw socket_exception("Unable to create eventfd", true);
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = wakefd;
+    if (::epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0)
+    {
+        ::close(wakefd);
+        ::close(epfd);
+        throw socket_exception("Unable to add eventfd to epoll set", true);
+    }
+}
+
+socket_set::~socket_set()
+{
+    delete[] events;
+    ::close(wakefd);
+    ::close(epfd);
+}
+
+void socket_set::add_socket(tcp_socket *sock, void *data)
+{
+    int fd = sock->getSocket();
+
+    // Interest is registered once, edge triggered, for both directions.
+    // Hangups are reported as readable so the owner sees the 0 byte recv.
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+
+    if (::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        throw socket_exception("Unable to add socket to epoll set", true);
+    nsocks++;
+
+    if (fd >= static_cast<int>(entries.size()))
+        entries.resize(fd + 1);
+    entry e = { sock, data, false };
+    entries[fd] = e;
+}
+
+void socket_set::remove_socket(tcp_socket *sock)
+{
+    int fd = sock->getSocket();
+
+    // The event argument is ignored but must be non NULL on older kernels
+    struct epoll_event ev;
+    if (::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev) == 0)
+        nsocks--;
+
+    if (fd < static_cast<int>(entries.size()))
+        entries[fd].sock = NULL;
+}
+
+void socket_set::want_write(tcp_socket *, bool)
+{
+    // Writability edges are always reported
+}
+
+std::vector<tcp_socket*> socket_set::poll_sockets()
+{
+    std::vector<socket_event> events = poll_events();
+
+    std::vector<tcp_socket*> ret;
+    ret.reserve(events.size());
+    for (size_t i = 0; i < events.size(); i++)
+        if (events[i].readable)
+            ret.push_back(events[i].sock);
+
+    return ret;
+}
+
+std::vector<socket_event> socket_set::poll_events(int timeout_ms)
+{
+    std::vector<socket_event> ret;
+    poll_events(ret, timeout_ms);
+    return ret;
+}
+
+void socket_set::poll_events(std::vector<socket_event>& ret, int timeout_ms)
+{
+    ret.clear();
+
+    // Grow the event buffer along with the set so a single wait can report
+    // every ready socket
+    if (max_events < nsocks || !events)
+    {
+        delete[] events;
+        max_events = nsocks > 16 ? nsocks : 16;
+        events = new epoll_event[max_events];
+    }
+
+    int nready = ::epoll_wait(epfd, events, max_events, timeout_ms);
+    if (nready < 0)
+    {
+        if (errno == EINTR)
+            return;
+        throw socket_exception("Unable to wait on epoll set", true);
+    }
+
+    ret.reserve(nready);
+    for (int i = 0; i < nready; i++)
+    {
+        int fd = events[i].data.fd;
+        if (fd == wakefd)
+        {
+            uint64_t count;
+            while (::read(wakefd, &count, sizeof(count)) > 0)
+                ;
+            continue;
+        }
+
+        const entry& e = entries[fd];
+        if (!e.sock)
+            continue;
+
+        unsigned int flags = events[i].events;
+        socket_event ev;
+        ev.sock = e.sock;
+        ev.data = e.data;
+        ev.readable = (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+        ev.writable = (flags & (EPOLLOUT | EPOLLERR)) != 0;
+        ret.push_back(ev);
+    }
+}
+
+void socket_set::interrupt()
+{
+    uint64_t one = 1;
+    if (::write(wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        throw socket_exception("Unable to interrupt poll", true);
+}
+
+bool socket_set::edge_triggered() const
+{
+    return true;
+}
+
+#else
+
 socket_set::socket_set()
     : socks()
 {
-    // Empty
+    wakefds[0] = wakefds[1] = -1;
+#ifndef _MSC_VER
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, wakefds) < 0)
+        throw socket_exception("Unable to create wakeup sockets", true);
+    ::fcntl(wakefds[0], F_SETFL, O_NONBLOCK);
+    ::fcntl(wakefds[1], F_SETFL, O_NONBLOCK);
+#endif
 }
 
 socket_set::~socket_set()
 {
-    // Empty
+#ifndef _MSC_VER
+    ::close(wakefds[0]);
+    ::close(wakefds[1]);
+#endif
 }
 
-void socket_set::add_socket(tcp_socket *sock)
+void socket_set::add_socket(tcp_socket *sock, void *data)
 {
-    socks.push_back(sock);
+    if (sock->getSocket() >= FD_SETSIZE)
+        throw socket_exception("Socket does not fit in an fd_set", false);
+    entry e = { sock, data, false };
+    socks.push_back(e);
 }
 
 void socket_set::remove_socket(tcp_socket *sock)
 {
-    socks.remove(sock);
+    for (std::list<entry>::iterator it = socks.begin(); it != socks.end(); it++)
+    {
+        if (it->sock == sock)
+        {
+            socks.erase(it);
+            return;
+        }
+    }
+}
+
+void socket_set::want_write(tcp_socket *sock, bool want)
+{
+    for (std::list<entry>::iterator it = socks.begin(); it != socks.end(); it++)
+        if (it->sock == sock)
+            it->want_write = want;
 }
 
 std::vector<tcp_socket*> socket_set::poll_sockets()
 {
-    fd_set rset;
+    std::vector<socket_event> events = poll_events();
+
+    std::vector<tcp_socket*> ret;
+    for (size_t i = 0; i < events.size(); i++)
+        if (events[i].readable)
+            ret.push_back(events[i].sock);
+
+    return ret;
+}
+
+std::vector<socket_event> socket_set::poll_events(int timeout_ms)
+{
+    std::vector<socket_event> ret;
+    poll_events(ret, timeout_ms);
+    return ret;
+}
+
+void socket_set::poll_events(std::vector<socket_event>& ret, int timeout_ms)
+{
+    ret.clear();
+
+    fd_set rset, wset;
     FD_ZERO(&rset);
+    FD_ZERO(&wset);
 
-    int maxfd = -1;
-    for (std::list<tcp_socket*>::iterator it = socks.begin();
+    int maxfd = wakefds[0];
+    if (wakefds[0] >= 0)
+        FD_SET(wakefds[0], &rset);
+    for (std::list<entry>::iterator it = socks.begin();
          it != socks.end(); it++)
     {
-        int curfd = (*it)->getSocket();
+        int curfd = it->sock->getSocket();
         FD_SET(curfd, &rset);
+        if (it->want_write)
+            FD_SET(curfd, &wset);
         if (curfd > maxfd)
             maxfd = curfd;
     }
 
-    ::select(maxfd + 1, &rset, NULL, NULL, NULL);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if (::select(maxfd + 1, &rset, &wset, NULL, timeout_ms < 0 ? NULL : &tv) <= 0)
+    {
+        // Nothing is set on a timeout, and the sets are undefined on an error
+        FD_ZERO(&rset);
+        FD_ZERO(&wset);
+    }
 
-    std::vector<tcp_socket*> ret;
-    for (std::list<tcp_socket*>::iterator it = socks.begin();
+    if (wakefds[0] >= 0 && FD_ISSET(wakefds[0], &rset))
+    {
+        char buf[64];
+        while (::recv(wakefds[0], buf, sizeof(buf), 0) > 0)
+            ;
+    }
+
+    for (std::list<entry>::iterator it = socks.begin();
          it != socks.end(); it++)
     {
-        int curfd = (*it)->getSocket();
-        if (FD_ISSET(curfd, &rset))
-            ret.push_back(*it);
+        int curfd = it->sock->getSocket();
+        socket_event ev;
+        ev.sock = it->sock;
+        ev.data = it->data;
+        ev.readable = FD_ISSET(curfd, &rset) != 0;
+        ev.writable = FD_ISSET(curfd, &wset) != 0;
+        if (ev.readable || ev.writable)
+            ret.push_back(ev);
     }
+}
 
-    return ret;
+void socket_set::interrupt()
+{
+    if (wakefds[1] < 0)
+        throw socket_exception("Interrupting a poll is not supported here", false);
+    ::send(wakefds[1], "", 1, MSG_NOSIGNAL);
 }
 
+bool socket_set::edge_triggered() const
+{
+    return false;
+}
+
+#endif
+
 // End namespace kissnet
 };
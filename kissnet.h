@@ -4,6 +4,13 @@
 #include <vector>
 #include <list>
 
+// Linux gets the epoll backed socket_set, everything else falls back to select.
+// Define KISSNET_NO_EPOLL to force select (handy for comparisons).
+#if (defined(LINUX) || defined(__linux__)) && !defined(KISSNET_NO_EPOLL)
+#define KISSNET_USE_EPOLL
+struct epoll_event;
+#endif
+
 namespace kissnet
 {
 
@@ -27,6 +34,44 @@ private:
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
+// Immutable bytes shared by reference counting.  Copying a buffer only takes
+// a reference, so one encoded packet can be queued for any number of sockets,
+// on any number of threads, with a single allocation.  Buffers of up to
+// inline_size bytes aren't allocated at all, they are copied instead.
+class shared_buffer
+{
+public:
+    static const size_t inline_size = 16;
+
+    // An empty buffer
+    shared_buffer();
+    // Makes room for size bytes to be written through fill
+    explicit shared_buffer(size_t size);
+    shared_buffer(const char* data, size_t size);
+    explicit shared_buffer(const std::string& data);
+    shared_buffer(const shared_buffer& other);
+    shared_buffer& operator=(const shared_buffer& other);
+    ~shared_buffer();
+
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    // Writable bytes, only until the buffer is first copied
+    char* fill();
+
+private:
+    struct block;
+    void release();
+
+    // NULL for an empty or inline buffer
+    block *block_;
+    size_t size_;
+    char inline_[inline_size];
+};
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+
 class tcp_socket
 {
 public:
@@ -39,11 +84,28 @@ public:
     void close();
 
     void listen(const std::string& port, int backlog);
+    // Returns NULL if the socket is non blocking and nothing is pending
     tcp_socket * accept();
 
+    // On a non blocking socket send and recv return -1 if they would block
     int  send(const std::string& data);
+    int  send(const char* data, int data_len);
+    int  send(const shared_buffer& data);
+    // Sends count buffers with one system call where the platform allows.
+    // At most 64 buffers are sent per call.
+    int  send(const char* const* data, const size_t* data_lens, int count);
+    int  send(const shared_buffer* data, int count);
     int  recv(char* buffer, int buffer_len);
 
+    void set_nonblocking(bool nonblocking);
+    // TCP_NODELAY: small writes go out right away instead of waiting for the
+    // previous ones to be acknowledged.  Picks latency over fewer packets.
+    void set_nodelay(bool nodelay);
+    // TCP_CORK where there is one: partial segments are held back until the
+    // socket is uncorked, so a packet written in pieces goes out in full size
+    // segments.  Does nothing on other platforms.
+    void set_cork(bool cork);
+
     bool operator==(const tcp_socket& rhs) const;
 
     // Bare metal functions
@@ -56,18 +118,72 @@ private:
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
+struct socket_event
+{
+    tcp_socket *sock;
+    // Whatever was passed to add_socket with this socket
+    void *data;
+    bool readable;
+    bool writable;
+};
+
 class socket_set
 {
 public:
     socket_set();
     ~socket_set();
 
-    void add_socket(tcp_socket* sock);
+    // Sockets are registered once and stay registered until removed
+    void add_socket(tcp_socket* sock, void* data = NULL);
     void remove_socket(tcp_socket* sock);
 
+    // Asks to be told when the socket can take more data.  The epoll backend
+    // always reports writability edges so this only matters for select.
+    void want_write(tcp_socket* sock, bool want);
+
+    // Blocks until at least one socket is readable and returns those sockets.
+    // When edge_triggered() is true a socket is only reported again after new
+    // data arrives, so callers must drain everything that is already buffered.
     std::vector<tcp_socket*> poll_sockets();
+    // Same as poll_sockets but also reports writability.  When edge triggered
+    // a socket is only reported writable again after a send would have blocked.
+    // Gives up after timeout_ms milliseconds unless it is negative.
+    std::vector<socket_event> poll_events(int timeout_ms = -1);
+    // Same again, filling events so a loop can reuse one vector
+    void poll_events(std::vector<socket_event>& events, int timeout_ms = -1);
+
+    // Makes a poll in progress, or the next one, return early.  This is the
+    // only socket_set function that may be called from another thread.
+    void interrupt();
+
+    bool edge_triggered() const;
+
 private:
-    std::list<tcp_socket*> socks;
+    // Not copyable
+    socket_set(const socket_set&);
+    socket_set& operator=(const socket_set&);
+
+    struct entry
+    {
+        tcp_socket *sock;
+        void *data;
+        bool want_write;
+    };
+
+#ifdef KISSNET_USE_EPOLL
+    int epfd;
+    // eventfd written by interrupt
+    int wakefd;
+    int nsocks;
+    epoll_event *events;
+    int max_events;
+    // Registered sockets indexed by descriptor
+    std::vector<entry> entries;
+#else
+    std::list<entry> socks;
+    // Connected pair, interrupt writes to the second one
+    int wakefds[2];
+#endif
 };
 
 // -----------------------------------------------------------------------------
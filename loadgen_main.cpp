@@ -0,0 +1,531 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "kissnet.h"
+#include "crossword_board.hpp"
+#include "crossword_protocol.h"
+#include "crossword_server.h"
+#include "frame_reader.h"
+
+// Headless solvers for load testing a running server.  Every bot joins a room,
+// decodes the board it is sent and then types the answers into it a word at a
+// time, moving its cursor as it goes, and erases the word again before moving
+// on to another one so the rooms never finish.  The server echoes every
+// update back to its sender, the time until a bot sees its own letter come
+// back is the echo latency.
+
+// Bots give up typing while this much is still waiting to be sent
+#define MAX_OUTBOX 4096
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+static double now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1));
+    return samples[idx];
+}
+
+// Each bot needs a descriptor, and another one on the server when it is local
+static void raise_fd_limit()
+{
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+static void append_header(std::string& out, int type, int size)
+{
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(size / 256));
+    out.push_back(static_cast<char>(size % 256));
+}
+
+static void append_cell(std::string& out, int type, int x, int y, char ch)
+{
+    append_header(out, type, 3);
+    out.push_back(static_cast<char>(x));
+    out.push_back(static_cast<char>(y));
+    out.push_back(ch);
+}
+
+// -----------------------------------------------------------------------------
+// Bots
+// -----------------------------------------------------------------------------
+struct load_options
+{
+    std::string host, port;
+    std::string puzzle;
+    int bots;
+    int room_size;
+    int threads;
+    double rate;
+    double seconds;
+    double max_p99;
+};
+
+// A letter that was sent and has not come back yet
+struct pending_cell
+{
+    int x, y;
+    char ch;
+    double sent;
+};
+
+struct bot
+{
+    kissnet::tcp_socket *sock;
+    frame_reader reader;
+    crossword_board board;
+    // Bytes the socket would not take yet
+    std::string outbox;
+    // Sent letters in the order the server will echo them
+    std::deque<pending_cell> pending;
+
+    // Word being typed, and the position of the next keystroke in it
+    int word;
+    int pos;
+    bool erasing;
+    bool closed;
+
+    bot() : sock(0), word(-1), pos(0), erasing(false), closed(false) {}
+    ~bot() { delete sock; }
+};
+
+// What one thread saw, merged at the end
+struct load_stats
+{
+    std::vector<double> setup;
+    std::vector<double> echo;
+    long sent;
+    long received;
+    long stalls;
+    long failed;
+    long disconnects;
+
+    load_stats() : sent(0), received(0), stalls(0), failed(0), disconnects(0) {}
+
+    void merge(const load_stats& other)
+    {
+        setup.insert(setup.end(), other.setup.begin(), other.setup.end());
+        echo.insert(echo.end(), other.echo.begin(), other.echo.end());
+        sent += other.sent;
+        received += other.received;
+        stalls += other.stalls;
+        failed += other.failed;
+        disconnects += other.disconnects;
+    }
+};
+
+/**
+ * Connects a bot and waits for its board, like the client does when it joins.
+ * @param b The bot, its socket is left blocking.
+ * @param room_id The room to join.
+ */
+static void join_room(bot& b, const load_options& opts, const std::string& room_id)
+{
+    b.sock = new kissnet::tcp_socket();
+    b.sock->connect(opts.host, opts.port);
+
+    std::string payload = room_id;
+    payload.push_back('\0');
+    payload.push_back(static_cast<char>(crossword_board::binary_version));
+    payload.push_back(static_cast<char>(PROTOCOL_VERSION));
+    std::string request;
+    append_header(request, BOARD_REQUEST_TYPE, payload.size());
+    request.append(payload);
+    b.sock->send(request);
+
+    for (;;)
+    {
+        if (b.reader.fill(*b.sock) == 0)
+            throw kissnet::socket_exception("Server closed the connection");
+
+        int type, size;
+        const char *data;
+        while (b.reader.next(type, data, size))
+        {
+            if (type == BINARY_BOARD_TYPE)
+            {
+                b.board.read_binary(data, size);
+                return;
+            }
+            if (type == BOARD_TYPE)
+            {
+                std::istringstream in(std::string(data, size));
+                b.board.read(in);
+                return;
+            }
+        }
+    }
+}
+
+// Picks a random word with at least one cell
+static int random_word(const crossword_board& board, std::minstd_rand& rng)
+{
+    for (;;)
+    {
+        int x = rng() % board.xdim();
+        int y = rng() % board.ydim();
+        int dir = rng() % 2 ? crossword_board::across_dir : crossword_board::down_dir;
+        int word = board.word_at(x, y, dir);
+        if (word >= 0)
+            return word;
+    }
+}
+
+// Writes as much of the outbox as the socket takes
+static void flush(bot& b)
+{
+    while (!b.outbox.empty())
+    {
+        int bytes = b.sock->send(b.outbox.data(), b.outbox.size());
+        if (bytes <= 0)
+            return;
+        b.outbox.erase(0, bytes);
+    }
+}
+
+/**
+ * Sends the bot's next keystroke: an UPDATE with the letter, or a blank when
+ * erasing, then a CURSOR on the cell it moves to.
+ */
+static void keystroke(bot& b, std::minstd_rand& rng, load_stats& stats, double now)
+{
+    if (b.outbox.size() > MAX_OUTBOX)
+    {
+        stats.stalls++;
+        return;
+    }
+
+    if (b.word < 0)
+    {
+        b.word = random_word(b.board, rng);
+        b.pos = 0;
+        b.erasing = false;
+    }
+    const crossword_word& word = b.board.word(b.word);
+    int dx = word.dir == crossword_board::across_dir ? 1 : 0;
+    int dy = 1 - dx;
+
+    int x = word.x + dx * b.pos;
+    int y = word.y + dy * b.pos;
+    char ch = b.erasing ? ' ' : b.board.answer_at(x, y);
+    append_cell(b.outbox, UPDATE_TYPE, x, y, ch);
+    pending_cell cell = { x, y, ch, now };
+    b.pending.push_back(cell);
+
+    // Typing walks forward through the word and erasing walks back, then the
+    // bot turns around or picks a new word
+    if (!b.erasing && b.pos + 1 < word.length)
+        b.pos++;
+    else if (!b.erasing)
+        b.erasing = true;
+    else if (b.pos > 0)
+        b.pos--;
+    else
+        b.word = -1;
+
+    if (b.word >= 0)
+        append_cell(b.outbox, CURSOR_TYPE, word.x + dx * b.pos, word.y + dy * b.pos,
+                static_cast<char>(word.dir));
+    else
+        append_cell(b.outbox, CURSOR_TYPE, x, y, static_cast<char>(word.dir));
+    stats.sent += 2;
+
+    flush(b);
+}
+
+// Matches an echoed cell against the bot's own letters.  Letters typed by the
+// other bots in the room do not match anything.  If a letter was coalesced
+// away on the server the later one still matches and the lost ones are dropped.
+static void echoed(bot& b, int x, int y, char ch, load_stats& stats, double now)
+{
+    for (size_t i = 0; i < b.pending.size(); i++)
+    {
+        const pending_cell& cell = b.pending[i];
+        if (cell.x == x && cell.y == y && cell.ch == ch)
+        {
+            stats.echo.push_back(now - cell.sent);
+            b.pending.erase(b.pending.begin(), b.pending.begin() + i + 1);
+            return;
+        }
+    }
+}
+
+// Reads everything the bot has been sent, edge triggered sets need it all
+static void read_frames(bot& b, kissnet::socket_set& set, load_stats& stats)
+{
+    try
+    {
+        int bytes;
+        while ((bytes = b.reader.fill(*b.sock)) != -1)
+        {
+            if (bytes == 0)
+                throw kissnet::socket_exception("Server closed the connection");
+
+            double now = now_usec();
+            int type, size;
+            const char *data;
+            while (b.reader.next(type, data, size))
+            {
+                stats.received++;
+                if (type == UPDATE_TYPE || type == UPDATE_BATCH_TYPE)
+                {
+                    for (int i = 0; i + 3 <= size; i += 3)
+                        echoed(b, static_cast<unsigned char>(data[i]),
+                                static_cast<unsigned char>(data[i + 1]), data[i + 2],
+                                stats, now);
+                }
+            }
+        }
+    }
+    catch (kissnet::socket_exception& e)
+    {
+        set.remove_socket(b.sock);
+        b.closed = true;
+        stats.disconnects++;
+    }
+}
+
+/**
+ * Joins this thread's share of the bots, one after another.
+ * @param first The index of the first bot, every threads'th one after it
+ * belongs to this thread too.
+ */
+static void setup_bots(const load_options& opts, std::vector<bot*>& bots, int first,
+        load_stats& stats)
+{
+    for (size_t i = first; i < bots.size(); i += opts.threads)
+    {
+        std::ostringstream room_id;
+        room_id << opts.puzzle << "/load" << getpid() << '-' << i / opts.room_size;
+
+        double start = now_usec();
+        try
+        {
+            join_room(*bots[i], opts, room_id.str());
+            stats.setup.push_back(now_usec() - start);
+        }
+        catch (std::exception& e)
+        {
+            if (stats.failed++ == 0)
+                std::cout << "join failed: " << e.what() << '\n';
+            bots[i]->closed = true;
+        }
+    }
+}
+
+// Types on every bot of this thread until the deadline
+static void drive_bots(const load_options& opts, std::vector<bot*>& bots, int first,
+        double deadline, load_stats& stats)
+{
+    std::minstd_rand rng(first + 1);
+    std::uniform_real_distribution<double> jitter(0.5, 1.5);
+    const double interval = 1e6 / opts.rate;
+
+    kissnet::socket_set set;
+    typedef std::pair<double, bot*> due_key;
+    std::priority_queue<due_key, std::vector<due_key>, std::greater<due_key> > due;
+    double start = now_usec();
+    for (size_t i = first; i < bots.size(); i += opts.threads)
+    {
+        if (bots[i]->closed)
+            continue;
+        bots[i]->sock->set_nonblocking(true);
+        set.add_socket(bots[i]->sock, bots[i]);
+        // Spread the first keystrokes over one interval
+        due.push(due_key(start + interval * jitter(rng) / 1.5, bots[i]));
+    }
+
+    for (;;)
+    {
+        double now = now_usec();
+        if (now >= deadline)
+            break;
+
+        while (!due.empty() && due.top().first <= now)
+        {
+            due_key next = due.top();
+            due.pop();
+            if (next.second->closed)
+                continue;
+            keystroke(*next.second, rng, stats, now);
+            due.push(due_key(next.first + interval * jitter(rng), next.second));
+        }
+
+        double wake = due.empty() ? deadline : std::min(deadline, due.top().first);
+        int timeout = static_cast<int>((wake - now) / 1000) + 1;
+        std::vector<kissnet::socket_event> events = set.poll_events(timeout);
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            bot& b = *static_cast<bot*>(events[i].data);
+            if (events[i].readable && !b.closed)
+                read_frames(b, set, stats);
+            if (events[i].writable && !b.closed)
+                flush(b);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+static void usage(const char *prog)
+{
+    std::cout << "usage: " << prog << " [options] [host] [port]\n"
+        "options:\n"
+        "  -bots n      simulated solvers (default 1000)\n"
+        "  -room n      bots per room (default 4)\n"
+        "  -puzzle name play rooms of the server's <name>.xml instead of its\n"
+        "               default puzzle\n"
+        "  -rate n      keystrokes per second per bot, each sends an update and\n"
+        "               a cursor (default 5)\n"
+        "  -seconds n   how long to type for (default 10)\n"
+        "  -threads n   threads driving the bots, 0 for one per core (default 1)\n"
+        "  -max-p99 us  exit with an error if the p99 echo latency is higher\n";
+}
+
+int main(int argc, char **argv)
+{
+    load_options opts;
+    opts.host = "127.0.0.1";
+    opts.port = CROSSWORD_PORT;
+    opts.bots = 1000;
+    opts.room_size = 4;
+    opts.threads = 1;
+    opts.rate = 5;
+    opts.seconds = 10;
+    opts.max_p99 = 0;
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg[0] != '-')
+        {
+            args.push_back(arg);
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "-bots")
+            opts.bots = atoi(value.c_str());
+        else if (arg == "-room")
+            opts.room_size = atoi(value.c_str());
+        else if (arg == "-puzzle")
+            opts.puzzle = value;
+        else if (arg == "-rate")
+            opts.rate = atof(value.c_str());
+        else if (arg == "-seconds")
+            opts.seconds = atof(value.c_str());
+        else if (arg == "-threads")
+            opts.threads = atoi(value.c_str());
+        else if (arg == "-max-p99")
+            opts.max_p99 = atof(value.c_str());
+        else
+        {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (args.size() > 2 || opts.bots < 1 || opts.room_size < 1 || opts.rate <= 0)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if (args.size() > 0)
+        opts.host = args[0];
+    if (args.size() > 1)
+        opts.port = args[1];
+    if (opts.threads <= 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    kissnet::init_networking();
+    raise_fd_limit();
+
+    std::vector<bot*> bots;
+    for (int i = 0; i < opts.bots; i++)
+        bots.push_back(new bot());
+    std::vector<load_stats> stats(opts.threads);
+    std::vector<std::thread> threads;
+
+    std::cout << opts.bots << " bots in " << (opts.bots + opts.room_size - 1) / opts.room_size
+        << " rooms on " << opts.threads << " threads, " << opts.rate
+        << " keystrokes/s each for " << opts.seconds << "s\n";
+
+    double setup_start = now_usec();
+    for (int t = 0; t < opts.threads; t++)
+        threads.push_back(std::thread(setup_bots, std::cref(opts), std::ref(bots), t,
+                    std::ref(stats[t])));
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    threads.clear();
+    double setup_elapsed = now_usec() - setup_start;
+
+    double traffic_start = now_usec();
+    double deadline = traffic_start + opts.seconds * 1e6;
+    for (int t = 0; t < opts.threads; t++)
+        threads.push_back(std::thread(drive_bots, std::cref(opts), std::ref(bots), t,
+                    deadline, std::ref(stats[t])));
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    double traffic_elapsed = now_usec() - traffic_start;
+
+    load_stats total;
+    for (size_t t = 0; t < stats.size(); t++)
+        total.merge(stats[t]);
+    for (size_t i = 0; i < bots.size(); i++)
+        delete bots[i];
+
+    double p99 = percentile(total.echo, 0.99);
+    std::cout << std::fixed << std::setprecision(0)
+        << "setup    " << total.setup.size() << " joins in " << setup_elapsed / 1e3
+        << " ms, " << total.setup.size() * 1e6 / setup_elapsed << " joins/s  p50 "
+        << percentile(total.setup, 0.50) << " us  p99 "
+        << percentile(total.setup, 0.99) << " us\n"
+        << "traffic  " << total.sent * 1e6 / traffic_elapsed << " msgs/s sent  "
+        << total.received * 1e6 / traffic_elapsed << " msgs/s received\n"
+        << "echo     p50 " << percentile(total.echo, 0.50) << " us  p99 " << p99
+        << " us  p999 " << percentile(total.echo, 0.999) << " us  ("
+        << total.echo.size() << " samples)\n"
+        << "errors   " << total.failed << " failed joins  " << total.disconnects
+        << " disconnects  " << total.stalls << " stalled keystrokes\n";
+
+    if (total.failed > 0 || total.disconnects > 0 || total.echo.empty())
+        return 1;
+    if (opts.max_p99 > 0 && p99 > opts.max_p99)
+    {
+        std::cout << "p99 echo latency is over " << opts.max_p99 << " us\n";
+        return 1;
+    }
+    return 0;
+}
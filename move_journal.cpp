@@ -0,0 +1,649 @@
+#include "move_journal.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define fsync _commit
+#else
+#include <unistd.h>
+#endif
+
+/// Bytes before and after the payload of every record
+static const size_t record_header = 7;
+static const size_t record_trailer = 4;
+/// The most cells one update record carries
+static const size_t max_cells = 0xffff / 3;
+/// Snapshot files start with this
+static const char snapshot_magic[] = "XWS2";
+
+static void put_u16(std::string& out, unsigned long value)
+{
+    out.push_back(static_cast<char>((value >> 8) & 0xff));
+    out.push_back(static_cast<char>(value & 0xff));
+}
+
+static void put_u32(std::string& out, unsigned long value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+static void put_i64(std::string& out, long long value)
+{
+    unsigned long long bits = static_cast<unsigned long long>(value);
+    for (int shift = 56; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((bits >> shift) & 0xff));
+}
+
+static unsigned long get_u16(const unsigned char *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return static_cast<unsigned long>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static long long get_i64(const unsigned char *p)
+{
+    unsigned long long bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits = bits << 8 | p[i];
+    return static_cast<long long>(bits);
+}
+
+/// FNV-1a, enough to spot a record torn by a crash
+static unsigned long checksum(const char *data, size_t size)
+{
+    unsigned long hash = 2166136261UL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash = (hash * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+/// Reads a whole file, returns false if it can't be opened
+static bool read_file(const std::string& path, std::string& data)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    char buf[65536];
+    int bytes;
+    while ((bytes = read(fd, buf, sizeof(buf))) > 0)
+        data.append(buf, bytes);
+    close(fd);
+    return true;
+}
+
+static bool file_exists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+/// Writes all of data, returns false on an error
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        int bytes = write(fd, data, size);
+        if (bytes < 0)
+            return false;
+        data += bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+/// Flushes fd to the disk, returns false on an error
+static bool sync_file(int fd)
+{
+#if defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+/**
+ * Opens the journal, starts a new segment after the ones already on disk and
+ * starts the writer thread.
+ * @param path Where the segments and the snapshot live, see the class comment.
+ */
+move_journal::move_journal(const std::string& path)
+: path_(path), fd_(-1), first_segment_(1), segment_(0), snapshot_data_(),
+    next_room_(0), pending_(), appended_(0), durable_(0), syncs_(0),
+    stopping_(false), snapshot_every_(0), snapshot_requested_(false),
+    next_snapshot_(), generation_(0), snapshotting_(false), snapshot_segment_(0),
+    answered_(0), snapshots_(0), segment_bytes_(0), failed_(false)
+{
+    // The snapshot names the first segment it doesn't cover, the rest follow
+    // on from there
+    std::string snapshot;
+    if (read_file(path + ".snap", snapshot))
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char*>(snapshot.data());
+        if (snapshot.size() < 16 || snapshot.compare(0, 4, snapshot_magic) != 0 ||
+                checksum(snapshot.data(), snapshot.size() - 4) !=
+                get_u32(p + snapshot.size() - 4))
+            throw std::runtime_error("Journal snapshot " + path + ".snap is damaged");
+
+        snapshot_data_.swap(snapshot);
+        first_segment_ = static_cast<int>(get_u32(p + 4));
+    }
+
+    segment_ = first_segment_;
+    while (file_exists(segment_path(segment_)))
+        segment_++;
+    open_segment(segment_);
+
+    writer_ = std::thread(&move_journal::write_loop, this);
+}
+
+/// Destructor, waits for the writer to finish
+move_journal::~move_journal()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    close(fd_);
+}
+
+std::string move_journal::segment_path(int seq) const
+{
+    std::ostringstream out;
+    out << path_ << '.' << seq;
+    return out.str();
+}
+
+void move_journal::open_segment(int seq)
+{
+    int fd = open(segment_path(seq).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Unable to open journal " + segment_path(seq));
+
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = fd;
+    segment_bytes_ = 0;
+}
+
+/**
+ * Finds the room with a journal number, growing the table as needed.
+ */
+static crossword_room *&numbered_room(std::vector<crossword_room*>& numbered, int room_no)
+{
+    if (numbered.size() <= static_cast<size_t>(room_no))
+        numbered.resize(room_no + 1);
+    return numbered[room_no];
+}
+
+/**
+ * Makes the room a snapshot or journal names, unless it exists already.
+ * @return The room or NULL if its puzzle is gone.
+ */
+static crossword_room *make_room(puzzle_library& puzzles,
+        std::map<std::string, crossword_room*>& rooms, const std::string& room_id,
+        int room_no)
+{
+    std::map<std::string, crossword_room*>::iterator it = rooms.find(room_id);
+    if (it != rooms.end())
+        return it->second;
+
+    const crossword_board *puzzle = puzzles.puzzle_for_room(room_id);
+    if (!puzzle)
+    {
+        std::cout << "No puzzle for journaled room \"" << room_id << "\"\n";
+        return 0;
+    }
+    crossword_room *room = new crossword_room(room_id, *puzzle);
+    room->set_journal_id(room_no);
+    rooms[room_id] = room;
+    return room;
+}
+
+/**
+ * Loads the snapshot and replays the journal.  Rooms whose puzzle can't be
+ * found are skipped.  Replay of a segment stops at its first damaged record.
+ * @param puzzles Where the rooms' puzzles come from.
+ * @param rooms OUT PARAM gets the rebuilt rooms, keyed by id.
+ * @return The number of good records.
+ */
+long move_journal::recover(puzzle_library& puzzles,
+        std::map<std::string, crossword_room*>& rooms)
+{
+    // Rooms by journal number, NULL for rooms that could not be rebuilt.  The
+    // numbers are handed out in order so they stay dense.
+    std::vector<crossword_room*> numbered;
+    int max_room = -1;
+
+    if (!snapshot_data_.empty())
+    {
+        // Every field is checked against the end, the checksum only says the
+        // file is as it was written
+        const unsigned char *p =
+            reinterpret_cast<const unsigned char*>(snapshot_data_.data());
+        size_t end = snapshot_data_.size() - 4;
+        size_t count = get_u32(p + 8);
+        size_t pos = 12;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (pos + 6 > end || pos + 6 + get_u16(p + pos + 4) + 21 > end)
+            {
+                std::cout << "Journal snapshot ends after " << i << " of " << count
+                    << " rooms, ignoring the rest\n";
+                break;
+            }
+            int room_no = static_cast<int>(get_u32(p + pos));
+            size_t id_size = get_u16(p + pos + 4);
+            std::string room_id(snapshot_data_, pos + 6, id_size);
+            pos += 6 + id_size;
+            time_t start = static_cast<time_t>(get_i64(p + pos));
+            time_t elapsed = static_cast<time_t>(get_i64(p + pos + 8));
+            bool paused = p[pos + 16] != 0;
+            size_t letters = get_u32(p + pos + 17);
+            pos += 21;
+            if (letters > end - pos)
+            {
+                std::cout << "Journal snapshot ends after " << i << " of " << count
+                    << " rooms, ignoring the rest\n";
+                break;
+            }
+
+            crossword_room *room = make_room(puzzles, rooms, room_id, room_no);
+            numbered_room(numbered, room_no) = room;
+            max_room = std::max(max_room, room_no);
+            if (room)
+            {
+                crossword_board& board = room->board();
+                if (letters == static_cast<size_t>(board.xdim() * board.ydim()))
+                {
+                    for (size_t j = 0; j < letters; j++)
+                        board.set_at(j % board.xdim(), j / board.xdim(), p[pos + j]);
+                }
+                room->restore_timer(start, elapsed, paused);
+            }
+            pos += letters;
+        }
+        snapshot_data_.clear();
+    }
+
+    long records = 0;
+    for (int seq = first_segment_; seq < segment_; seq++)
+    {
+        std::string data;
+        if (!read_file(segment_path(seq), data))
+            continue;
+
+        size_t pos = 0;
+        while (pos + record_header + record_trailer <= data.size())
+        {
+            const unsigned char *rec = reinterpret_cast<const unsigned char*>(&data[pos]);
+            char kind = static_cast<char>(rec[0]);
+            int room_no = static_cast<int>(get_u32(rec + 1));
+            size_t size = get_u16(rec + 5);
+            size_t total = record_header + size + record_trailer;
+            if (pos + total > data.size() ||
+                    checksum(&data[pos], record_header + size) !=
+                    get_u32(rec + record_header + size))
+                break;
+
+            const unsigned char *payload = rec + record_header;
+            if (kind == open_kind)
+            {
+                std::string room_id(reinterpret_cast<const char*>(payload), size);
+                numbered_room(numbered, room_no) =
+                    make_room(puzzles, rooms, room_id, room_no);
+                max_room = std::max(max_room, room_no);
+            }
+            else if (static_cast<size_t>(room_no) < numbered.size() && numbered[room_no])
+            {
+                crossword_room *room = numbered[room_no];
+                crossword_board& board = room->board();
+                if (kind == update_kind)
+                {
+                    for (size_t i = 0; i + 3 <= size; i += 3)
+                    {
+                        if (payload[i] < board.xdim() && payload[i + 1] < board.ydim())
+                            board.set_at(payload[i], payload[i + 1], payload[i + 2]);
+                    }
+                }
+                else if (kind == timer_kind && size >= 17)
+                {
+                    room->restore_timer(static_cast<time_t>(get_i64(payload)),
+                            static_cast<time_t>(get_i64(payload + 8)), payload[16] != 0);
+                }
+            }
+
+            pos += total;
+            records++;
+        }
+
+        // Appending carries on in a new segment, so the damage is left alone
+        if (pos < data.size())
+            std::cout << "Ignoring " << data.size() - pos << " damaged bytes at the "
+                "end of " << segment_path(seq) << '\n';
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    next_room_ = std::max(next_room_, max_room + 1);
+    return records;
+}
+
+int move_journal::open_room(const std::string& room_id)
+{
+    std::string record;
+    int room_no;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        room_no = next_room_++;
+    }
+    add_record(record, open_kind, room_no, room_id.data(),
+            std::min(room_id.size(), static_cast<size_t>(0xffff)));
+    append(record);
+    return room_no;
+}
+
+/**
+ * Encodes letters applied to a room.
+ * @param records The string to add the records to.
+ * @param room The room's journal number.
+ * @param cells x, y, ch triples.
+ */
+void move_journal::add_updates(std::string& records, int room, const std::string& cells)
+{
+    for (size_t i = 0; i < cells.size(); i += max_cells * 3)
+    {
+        size_t size = std::min(cells.size() - i, max_cells * 3);
+        add_record(records, update_kind, room, cells.data() + i, size);
+    }
+}
+
+/**
+ * Encodes the state of a room's timer, replaying it restores the timer as it
+ * was.
+ */
+void move_journal::add_timer(std::string& records, const crossword_room& room)
+{
+    std::string payload;
+    put_i64(payload, room.start_time());
+    put_i64(payload, room.elapsed_time());
+    payload.push_back(room.paused() ? 1 : 0);
+    add_record(records, timer_kind, room.journal_id(), payload.data(), payload.size());
+}
+
+void move_journal::add_record(std::string& records, char kind, int room,
+        const char *payload, size_t size)
+{
+    size_t start = records.size();
+    records.push_back(kind);
+    put_u32(records, room);
+    put_u16(records, size);
+    records.append(payload, size);
+    put_u32(records, checksum(records.data() + start, records.size() - start));
+}
+
+void move_journal::append(const std::string& records)
+{
+    if (records.empty())
+        return;
+
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        was_empty = pending_.empty();
+        pending_.append(records);
+        appended_ += records.size();
+    }
+    // A writer with something pending is busy and will look again
+    if (was_empty)
+        wake_.notify_one();
+}
+
+void move_journal::sync()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    long target = appended_;
+    while (durable_ < target)
+        synced_.wait(guard);
+}
+
+void move_journal::set_snapshot_every(int seconds)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        snapshot_every_ = seconds;
+        next_snapshot_ = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    }
+    wake_.notify_one();
+}
+
+void move_journal::request_snapshot()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        snapshot_requested_ = true;
+    }
+    wake_.notify_one();
+}
+
+void move_journal::add_loop(std::function<void()> wake)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    loops_.push_back(wake);
+}
+
+bool move_journal::snapshot_due(int& seen) const
+{
+    int generation = generation_.load();
+    if (generation == seen)
+        return false;
+
+    seen = generation;
+    return true;
+}
+
+/**
+ * Copies a room's letters and timer.  Only a few hundred bytes per room, the
+ * encoding and writing happen on the writer thread.
+ */
+void move_journal::save_room(std::vector<room_state>& states, const crossword_room& room)
+{
+    room_state state;
+    state.journal_id = room.journal_id();
+    state.room_id = room.id();
+    room.board().snapshot_letters(state.letters, true);
+    state.start_time = room.start_time();
+    state.elapsed_time = room.elapsed_time();
+    state.paused = room.paused();
+    states.push_back(state);
+}
+
+void move_journal::add_snapshot(std::vector<room_state>& states)
+{
+    bool complete;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (states_.empty())
+            states_.swap(states);
+        else
+            states_.insert(states_.end(), states.begin(), states.end());
+        answered_++;
+        complete = answered_ == loops_.size();
+    }
+    if (complete)
+        wake_.notify_one();
+}
+
+void move_journal::stats(long& bytes, long& syncs, long& snapshots)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    bytes = durable_;
+    syncs = syncs_;
+    snapshots = snapshots_;
+}
+
+/**
+ * Writes and syncs a batch of records to the open segment.
+ * @return False if the write or the sync failed.
+ */
+bool move_journal::write_batch(const std::string& batch)
+{
+    segment_bytes_ += batch.size();
+    if (!write_all(fd_, batch.data(), batch.size()))
+    {
+        std::cout << "Error writing the journal, moves are being lost\n";
+        return false;
+    }
+    if (!sync_file(fd_))
+    {
+        std::cout << "Error syncing the journal, moves may be lost\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes the snapshot next to the old one and renames it over it, then
+ * deletes the segments it covers.
+ * @param states Every room.
+ * @param first The first segment the snapshot doesn't cover.
+ */
+void move_journal::write_snapshot(const std::vector<room_state>& states, int first)
+{
+    std::string data(snapshot_magic, 4);
+    put_u32(data, first);
+    put_u32(data, states.size());
+    for (size_t i = 0; i < states.size(); i++)
+    {
+        const room_state& state = states[i];
+        size_t id_size = std::min(state.room_id.size(), static_cast<size_t>(0xffff));
+        put_u32(data, state.journal_id);
+        put_u16(data, id_size);
+        data.append(state.room_id, 0, id_size);
+        put_i64(data, state.start_time);
+        put_i64(data, state.elapsed_time);
+        data.push_back(state.paused ? 1 : 0);
+        put_u32(data, state.letters.size());
+        data.append(state.letters);
+    }
+    put_u32(data, checksum(data.data(), data.size()));
+
+    std::string path = path_ + ".snap";
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cout << "Unable to write journal snapshot " << tmp << '\n';
+        return;
+    }
+    bool ok = write_all(fd, data.data(), data.size()) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Unable to write journal snapshot " << path << '\n';
+        return;
+    }
+
+    // A segment that failed to sync may be all there is of its moves
+    if (failed_)
+        return;
+    for (int seq = first_segment_; seq < first; seq++)
+        remove(segment_path(seq).c_str());
+    first_segment_ = first;
+}
+
+/**
+ * Body of the writer thread.  Takes everything pending, writes it and syncs,
+ * so the records appended during one sync all share the next.  In between it
+ * starts and finishes snapshots.
+ */
+void move_journal::write_loop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    for (;;)
+    {
+        bool finish = snapshotting_ && answered_ == loops_.size();
+        bool start = !snapshotting_ && !failed_ && !loops_.empty() && (snapshot_requested_ ||
+                (snapshot_every_ > 0 && std::chrono::steady_clock::now() >= next_snapshot_));
+        if (pending_.empty() && !finish && !start)
+        {
+            if (stopping_)
+                break;
+            if (snapshot_every_ > 0 && !snapshotting_ && !failed_)
+                wake_.wait_until(guard, next_snapshot_);
+            else
+                wake_.wait(guard);
+            continue;
+        }
+
+        std::string batch;
+        batch.swap(pending_);
+        if (start)
+            snapshot_requested_ = false;
+        guard.unlock();
+
+        // Records appended before a new segment starts belong in the old one
+        if (!batch.empty() && !write_batch(batch) && !failed_)
+        {
+            std::cout << "Journal snapshots are off, old segments are kept from now on\n";
+            failed_ = true;
+        }
+
+        std::vector<std::function<void()> > wake;
+        if (start && segment_bytes_ > 0)
+        {
+            open_segment(segment_ + 1);
+            guard.lock();
+            segment_++;
+            snapshot_segment_ = segment_;
+            snapshotting_ = true;
+            answered_ = 0;
+            states_.clear();
+            generation_++;
+            wake = loops_;
+            guard.unlock();
+        }
+        else if (finish)
+        {
+            std::vector<room_state> states;
+            guard.lock();
+            states.swap(states_);
+            guard.unlock();
+            write_snapshot(states, snapshot_segment_);
+        }
+
+        // The loops copy their rooms once they are back from polling
+        for (size_t i = 0; i < wake.size(); i++)
+            wake[i]();
+
+        guard.lock();
+        if (finish)
+        {
+            snapshotting_ = false;
+            snapshots_++;
+        }
+        if (start)
+            next_snapshot_ = std::chrono::steady_clock::now() +
+                std::chrono::seconds(snapshot_every_);
+        if (!batch.empty())
+        {
+            durable_ += batch.size();
+            syncs_++;
+            synced_.notify_all();
+        }
+    }
+}
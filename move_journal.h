@@ -0,0 +1,151 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <ctime>
+#include "puzzle_library.h"
+#include "crossword_room.h"
+
+// Append-only log of everything that changes a room: the letters applied by
+// UPDATEs and the state of the game timer.  On startup it is replayed on top
+// of the puzzles to bring every room back as it was.
+//
+// Event loops collect the records of one iteration in a string and hand them
+// over with append.  A writer thread writes and syncs whatever has piled up
+// since its last sync, so many iterations share one fsync and the loops never
+// wait for the disk.  The price is that a crash loses the moves of the last
+// sync or so, which the players saw but the journal didn't keep.
+//
+// The journal is a series of segment files, <path>.1, <path>.2 and so on.
+// Each start of the server begins a new segment.  With snapshots turned on
+// the writer also begins a new segment every so often and asks the event
+// loops for a copy of their rooms.  Once every loop has answered the copies
+// are written to <path>.snap and the segments before the new one are
+// deleted.  Recovery loads the snapshot and replays the segments after it.
+// Replaying a record twice is harmless, the last letter written to a cell
+// and the last timer state win, so it doesn't matter that the loops copy
+// their rooms a little after the segment was started.
+//
+// Every record is
+//   kind (1 byte) | room number (4 bytes) | payload size (2 bytes) | payload |
+//   checksum (4 bytes)
+// with big endian numbers.  A record cut short by a crash fails its checksum
+// and is dropped, along with the rest of its segment.
+class move_journal
+{
+public:
+    // Record kinds
+    static const char open_kind = 'O';
+    static const char update_kind = 'U';
+    static const char timer_kind = 'T';
+
+    // What a snapshot keeps of a room
+    struct room_state
+    {
+        int journal_id;
+        std::string room_id;
+        std::string letters;
+        time_t start_time, elapsed_time;
+        bool paused;
+    };
+
+    // Opens the journal at path and begins a new segment.  Errors are thrown
+    // as runtime_error.
+    explicit move_journal(const std::string& path);
+    // Writes and syncs everything appended before returning
+    ~move_journal();
+
+    // Loads the snapshot, replays the segments after it and adds the rooms
+    // they describe to rooms, which takes ownership of them.  Must be called
+    // before anything is appended.  Returns the number of records replayed.
+    long recover(puzzle_library& puzzles, std::map<std::string, crossword_room*>& rooms);
+
+    // Numbers a new room and journals its id.  May be called from any thread.
+    int open_room(const std::string& room_id);
+
+    // Encode records onto the end of records, for append
+    static void add_updates(std::string& records, int room, const std::string& cells);
+    static void add_timer(std::string& records, const crossword_room& room);
+
+    // Queues records for the writer thread.  May be called from any thread.
+    void append(const std::string& records);
+    // Blocks until everything appended so far is on disk
+    void sync();
+
+    // Snapshots the rooms at most once per seconds, 0 turns snapshots off
+    void set_snapshot_every(int seconds);
+    // Starts a snapshot as soon as the one in progress, if any, is done
+    void request_snapshot();
+    // Every event loop holding rooms registers before it runs.  wake is
+    // called from the writer thread when a snapshot wants the loop's rooms.
+    void add_loop(std::function<void()> wake);
+    // True once per snapshot for each loop, which then hands its rooms to
+    // add_snapshot.  seen is the loop's own counter, starting at 0.
+    bool snapshot_due(int& seen) const;
+    // Copies what the snapshot needs of a room, cheap enough for the loop
+    static void save_room(std::vector<room_state>& states, const crossword_room& room);
+    // One loop's rooms for the snapshot in progress
+    void add_snapshot(std::vector<room_state>& states);
+
+    // Bytes written, syncs and snapshots done so far
+    void stats(long& bytes, long& syncs, long& snapshots);
+
+private:
+    // Not copyable
+    move_journal(const move_journal&);
+    move_journal& operator=(const move_journal&);
+
+    static void add_record(std::string& records, char kind, int room,
+            const char *payload, size_t size);
+    std::string segment_path(int seq) const;
+    void open_segment(int seq);
+    bool write_batch(const std::string& batch);
+    void write_snapshot(const std::vector<room_state>& states, int first);
+    void write_loop();
+
+    std::string path_;
+    int fd_;
+    // Segments on disk are first_segment_ .. segment_, the last one is open
+    int first_segment_, segment_;
+    // The snapshot read at startup, empty if there wasn't one
+    std::string snapshot_data_;
+
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable synced_;
+    int next_room_;
+    // Appended and not yet taken by the writer
+    std::string pending_;
+    // Bytes appended, and bytes written and synced, since the journal opened.
+    // Batches that failed to write count as done so sync doesn't wait forever.
+    long appended_, durable_;
+    long syncs_;
+    bool stopping_;
+
+    int snapshot_every_;
+    bool snapshot_requested_;
+    std::chrono::steady_clock::time_point next_snapshot_;
+    std::vector<std::function<void()> > loops_;
+    // Bumped when a snapshot starts, loops compare it with their own count
+    std::atomic<int> generation_;
+    bool snapshotting_;
+    // First segment the snapshot in progress doesn't cover
+    int snapshot_segment_;
+    size_t answered_;
+    std::vector<room_state> states_;
+    long snapshots_;
+    // Bytes written to the open segment, a segment with nothing new doesn't
+    // need a snapshot
+    long segment_bytes_;
+    // Set by the writer once a write or sync fails.  No snapshot starts after
+    // that, so nothing on disk is rotated or deleted behind lost moves.
+    bool failed_;
+
+    std::thread writer_;
+};
@@ -0,0 +1,154 @@
+#include "puzzle_library.h"
+#include <iostream>
+#include <stdexcept>
+#include <cctype>
+
+/**
+ * Constructor.
+ * @param dir Directory holding the named puzzles, empty if there are none.
+ */
+puzzle_library::puzzle_library(const std::string& dir)
+: dir_(dir), default_(0), puzzles_(), misses_(0)
+{
+}
+
+// Names that failed to load kept in puzzles_, so asking for missing puzzles
+// doesn't fill up the memory
+static const size_t max_misses = 4096;
+
+/// Destructor
+puzzle_library::~puzzle_library()
+{
+    delete default_;
+    std::map<std::string, crossword_board*>::iterator it = puzzles_.begin();
+    for (; it != puzzles_.end(); it++)
+        delete it->second;
+}
+
+/**
+ * Reads the default puzzle.  Errors in the puzzle are thrown.
+ * @param in The stream to read the puzzle from.
+ */
+void puzzle_library::set_default(std::istream& in)
+{
+    crossword_board *board = new crossword_board();
+    try
+    {
+        board->read(in);
+    }
+    catch (...)
+    {
+        delete board;
+        throw;
+    }
+
+    delete default_;
+    default_ = board;
+}
+
+/**
+ * Reads the default puzzle from a file.  Errors in the puzzle are thrown.
+ * @param path The puzzle file.
+ * @return False if the file can't be opened.
+ */
+bool puzzle_library::set_default(const std::string& path)
+{
+    crossword_board *board = new crossword_board();
+    try
+    {
+        if (!board->read_file(path))
+        {
+            delete board;
+            return false;
+        }
+    }
+    catch (...)
+    {
+        delete board;
+        throw;
+    }
+
+    delete default_;
+    default_ = board;
+    return true;
+}
+
+/**
+ * Picks the puzzle for a room.  Without a puzzle directory every room plays
+ * the default puzzle.
+ * @param room_id The room being joined.
+ * @return The puzzle or NULL.
+ */
+const crossword_board* puzzle_library::puzzle_for_room(const std::string& room_id)
+{
+    if (dir_.empty())
+        return default_;
+
+    return find(room_id.substr(0, room_id.find('/')));
+}
+
+/**
+ * Looks up a puzzle by name, reading it from the puzzle directory the first
+ * time it is asked for.  Only letters, digits, '-', '_' and '.' are allowed in
+ * names so a room id can't point outside the directory.  The file is read
+ * without holding the lock so other loops aren't kept waiting on the disk.
+ * @param name The puzzle name, empty for the default puzzle.
+ * @return The puzzle or NULL.
+ */
+const crossword_board* puzzle_library::find(const std::string& name)
+{
+    if (name.empty())
+        return default_;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        std::map<std::string, crossword_board*>::iterator it = puzzles_.find(name);
+        if (it != puzzles_.end())
+            return it->second;
+    }
+
+    if (dir_.empty() || name[0] == '.')
+        return 0;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        char ch = name[i];
+        if (!isalnum(static_cast<unsigned char>(ch)) && ch != '-' && ch != '_' && ch != '.')
+            return 0;
+    }
+
+    std::string path = dir_ + "/" + name + ".xml";
+    crossword_board *board = new crossword_board();
+    try
+    {
+        if (!board->read_file(path))
+        {
+            delete board;
+            board = 0;
+        }
+    }
+    catch (std::runtime_error& e)
+    {
+        std::cout << "Unable to read puzzle " << path << ": " << e.what() << '\n';
+        delete board;
+        board = 0;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    // Another loop may have read it meanwhile, the first one in is kept
+    std::map<std::string, crossword_board*>::iterator it = puzzles_.find(name);
+    if (it != puzzles_.end())
+    {
+        delete board;
+        return it->second;
+    }
+    if (!board)
+    {
+        if (misses_ >= max_misses)
+            return 0;
+        misses_++;
+    }
+    else
+        std::cout << "Loaded puzzle " << name << '\n';
+    puzzles_[name] = board;
+    return board;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <map>
+#include <string>
+#include <istream>
+#include <mutex>
+#include "crossword_board.hpp"
+
+// Loads puzzles by name and keeps one board per puzzle.  Rooms copy their
+// board from here, which shares the layout, answers and clues between every
+// room playing the same puzzle.  Lookups may come from several threads, the
+// returned boards live as long as the library.
+class puzzle_library
+{
+public:
+    // Named puzzles are read from <dir>/<name>.xml
+    explicit puzzle_library(const std::string& dir = "");
+    ~puzzle_library();
+
+    // Reads the puzzle used by rooms that don't name one
+    void set_default(std::istream& in);
+    // Same from a file, false if it can't be opened
+    bool set_default(const std::string& path);
+
+    // Returns the puzzle for a room, or NULL if there isn't one.  The puzzle
+    // name is the part of the room id before the first '/'.
+    const crossword_board* puzzle_for_room(const std::string& room_id);
+
+    // Returns the named puzzle, loading it on first use.  NULL if there is no
+    // such puzzle.  Names that fail are remembered too, so a puzzle added to
+    // the directory after being asked for may not be seen until a restart.
+    const crossword_board* find(const std::string& name);
+
+private:
+    // Not copyable
+    puzzle_library(const puzzle_library&);
+    puzzle_library& operator=(const puzzle_library&);
+
+    std::mutex lock_;
+    std::string dir_;
+    crossword_board *default_;
+    // NULL for names that couldn't be loaded, no more than max_misses of them
+    std::map<std::string, crossword_board*> puzzles_;
+    size_t misses_;
+};
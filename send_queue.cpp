@@ -0,0 +1,200 @@
+#include "send_queue.h"
+#include <cstring>
+#include <algorithm>
+
+/// Creates an empty queue, the buffer is allocated on first use.
+send_queue::send_queue()
+: buf_(0), capacity_(0), head_(0), ring_size_(0), ring_written_(0), refs_(),
+    ref_offset_(0), size_(0)
+{
+}
+
+/// Destructor
+send_queue::~send_queue()
+{
+    delete[] buf_;
+}
+
+/**
+ * Copies data onto the end of the queue, growing the buffer if needed.
+ * @param data The bytes to queue.
+ * @param len The number of bytes.
+ */
+void send_queue::append(const char* data, size_t len)
+{
+    if (len == 0)
+        return;
+    if (ring_size_ + len > capacity_)
+        grow(ring_size_ + len);
+
+    // Copy in at most two pieces, up to the end of the buffer and then from
+    // the start
+    size_t tail = (head_ + ring_size_) & (capacity_ - 1);
+    size_t first = std::min(len, capacity_ - tail);
+    memcpy(buf_ + tail, data, first);
+    memcpy(buf_, data + first, len - first);
+    ring_size_ += len;
+    size_ += len;
+}
+
+/**
+ * Copies a packet onto the end of the queue.
+ * @param data The packet to queue.
+ */
+void send_queue::append(const std::string& data)
+{
+    append(data.data(), data.size());
+}
+
+/**
+ * Queues a shared packet, by reference unless it is small enough to copy.
+ * @param data The packet to queue.
+ */
+void send_queue::append(const kissnet::shared_buffer& data)
+{
+    if (data.size() < copy_limit)
+    {
+        append(data.data(), data.size());
+        return;
+    }
+
+    reference ref = { data, ring_written_ + ring_size_ };
+    refs_.push_back(ref);
+    size_ += data.size();
+}
+
+/**
+ * Writes queued bytes to the socket until it would block or the queue is
+ * empty.  The ring and the references are gathered into one system call,
+ * so a queue of many small packets drains with a single write.
+ * @param sock A non blocking socket.
+ * @param calls If not NULL, counts the system calls made.
+ * @return The number of bytes written.
+ */
+size_t send_queue::flush(kissnet::tcp_socket& sock, unsigned long *calls)
+{
+    size_t written = 0;
+    while (size_ > 0)
+    {
+        const char *data[max_pieces];
+        size_t lens[max_pieces];
+        int count = 0;
+        size_t total = 0;
+
+        // Walk the queue in order: the ring bytes before each reference, in
+        // at most two pieces where the ring wraps, then the reference
+        size_t head = head_;
+        unsigned long long pos = ring_written_;
+        unsigned long long ring_end = ring_written_ + ring_size_;
+        for (size_t r = 0; count < max_pieces; r++)
+        {
+            unsigned long long until = r < refs_.size() ? refs_[r].at : ring_end;
+            while (pos < until && count < max_pieces)
+            {
+                size_t chunk = std::min(static_cast<size_t>(until - pos), capacity_ - head);
+                data[count] = buf_ + head;
+                lens[count++] = chunk;
+                total += chunk;
+                head = (head + chunk) & (capacity_ - 1);
+                pos += chunk;
+            }
+            if (r == refs_.size() || count == max_pieces)
+                break;
+
+            size_t skip = r == 0 ? ref_offset_ : 0;
+            data[count] = refs_[r].data.data() + skip;
+            lens[count++] = refs_[r].data.size() - skip;
+            total += refs_[r].data.size() - skip;
+        }
+
+        int sent = sock.send(data, lens, count);
+        if (calls)
+            (*calls)++;
+        if (sent <= 0)
+            break;
+        consume(sent);
+        written += sent;
+        if (static_cast<size_t>(sent) < total)
+            break;
+    }
+
+    // Start from the beginning again so small packets stay contiguous
+    if (ring_size_ == 0)
+        head_ = 0;
+
+    return written;
+}
+
+/**
+ * Drops len written bytes from the head of the queue, ring bytes and
+ * references in the order they were queued.
+ */
+void send_queue::consume(size_t len)
+{
+    while (len > 0)
+    {
+        size_t before = refs_.empty() ? ring_size_ :
+            static_cast<size_t>(refs_.front().at - ring_written_);
+        if (before > 0)
+        {
+            size_t chunk = std::min(len, before);
+            head_ = (head_ + chunk) & (capacity_ - 1);
+            ring_size_ -= chunk;
+            ring_written_ += chunk;
+            size_ -= chunk;
+            len -= chunk;
+            continue;
+        }
+
+        const kissnet::shared_buffer& data = refs_.front().data;
+        size_t chunk = std::min(len, data.size() - ref_offset_);
+        ref_offset_ += chunk;
+        size_ -= chunk;
+        len -= chunk;
+        if (ref_offset_ == data.size())
+        {
+            refs_.pop_front();
+            ref_offset_ = 0;
+        }
+    }
+}
+
+/**
+ * Number of bytes waiting to be written.
+ */
+size_t send_queue::size() const
+{
+    return size_;
+}
+
+/**
+ * True if there is nothing waiting to be written.
+ */
+bool send_queue::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+ * Reallocates the buffer to hold at least needed bytes, unwrapping the queued
+ * data to the start of the new buffer.
+ */
+void send_queue::grow(size_t needed)
+{
+    size_t capacity = capacity_ ? capacity_ : 1024;
+    while (capacity < needed)
+        capacity *= 2;
+
+    char *buf = new char[capacity];
+    size_t first = std::min(ring_size_, capacity_ - head_);
+    if (ring_size_ > 0)
+    {
+        memcpy(buf, buf_ + head_, first);
+        memcpy(buf + first, buf_, ring_size_ - first);
+    }
+
+    delete[] buf_;
+    buf_ = buf;
+    capacity_ = capacity;
+    head_ = 0;
+}
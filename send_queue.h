@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <cstddef>
+#include "kissnet.h"
+
+// Outbound byte ring buffer for a non blocking socket.  Packets are appended
+// at the tail and written from the head whenever the socket can take them.
+// Shared buffers too big to be worth copying are queued by reference and
+// written straight from the shared bytes, in order with the copied ones.
+class send_queue
+{
+public:
+    // Shared buffers smaller than this are copied into the ring
+    static const size_t copy_limit = 256;
+
+    send_queue();
+    ~send_queue();
+
+    void append(const char* data, size_t len);
+    void append(const std::string& data);
+    void append(const kissnet::shared_buffer& data);
+
+    // Writes as much as the socket accepts without blocking and returns the
+    // number of bytes written.  Socket errors are thrown.  calls, if given,
+    // is incremented for every system call.
+    size_t flush(kissnet::tcp_socket& sock, unsigned long *calls = 0);
+
+    size_t size() const;
+    bool empty() const;
+
+private:
+    // Not copyable
+    send_queue(const send_queue&);
+    send_queue& operator=(const send_queue&);
+
+    void grow(size_t needed);
+    // Pieces gathered into one write, the most kissnet sends at once
+    static const int max_pieces = 64;
+
+    void consume(size_t len);
+
+    // A buffer queued by reference after the ring byte numbered at
+    struct reference
+    {
+        kissnet::shared_buffer data;
+        unsigned long long at;
+    };
+
+    char *buf_;
+    // Always a power of two so positions wrap with a mask
+    size_t capacity_;
+    size_t head_;
+    // Ring bytes queued
+    size_t ring_size_;
+    // Ring bytes written since the queue was made, references are placed by
+    // this count
+    unsigned long long ring_written_;
+    std::deque<reference> refs_;
+    // Bytes of the first reference already written
+    size_t ref_offset_;
+    // Everything queued, ring and references
+    size_t size_;
+};
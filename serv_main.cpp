@@ -1,34 +1,272 @@
 #include "crossword_server.h"
 #include <fstream>
 #include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
 #include "kissnet.h"
 
+static void usage(const char *prog)
+{
+    std::cout << "usage: " << prog << " [options] crossword_file [port]\n"
+        "       " << prog << " [options] -dir puzzle_dir [crossword_file] [port]\n"
+        "options:\n"
+        "  -dir path    rooms named <puzzle>/<game> play <path>/<puzzle>.xml,\n"
+        "               rooms with no puzzle name play crossword_file\n"
+        "  -threads n   run n event loops with the rooms spread over them,\n"
+        "               0 for one per core (default 1)\n"
+        "  -tick ms     send cursors at most once per ms milliseconds, only the\n"
+        "               latest one per player (default 0, send right away)\n"
+        "  -low bytes   a lagging player catches up below this many queued bytes\n"
+        "  -high bytes  coalesce a player's updates above this many queued bytes\n"
+        "  -drop bytes  disconnect a player above this many queued bytes\n"
+        "  -stats path  write counters to path, - for stdout, in the Prometheus\n"
+        "               text format\n"
+        "  -stats-every seconds\n"
+        "               how often to write the counters (default 10)\n"
+        "  -journal path\n"
+        "               log every move to path and replay it on startup, so\n"
+        "               the rooms survive a restart\n"
+        "  -snapshot seconds\n"
+        "               snapshot the rooms this often so the journal can be\n"
+        "               trimmed, 0 to never (default 300)\n"
+        "  -record path record every message the players send to path\n"
+        "  -replay path play a recording into its rooms for spectators, who\n"
+        "               join the recorded rooms to watch (runs one event loop)\n"
+        "  -speed x     replay x times as fast as recorded, 0 for as fast as\n"
+        "               possible (default 1)\n"
+        "  -wait n      start the replay once n spectators have joined\n"
+        "               (default 0, right away)\n"
+        "  -nodelay 0|1 1 sends keystrokes right away, 0 lets the kernel batch\n"
+        "               small writes (default 1)\n"
+        "  -idle s      close rooms nobody has been in for s seconds, keeping\n"
+        "               the letters of played ones, 0 never (default 600)\n"
+        "  -keep s      forget the letters of closed rooms after s seconds,\n"
+        "               0 never (default 86400)\n"
+        "  -rooms n     refuse new rooms past n open per event loop, and keep\n"
+        "               no more than n closed ones, 0 for no limit (default 10000)\n";
+}
+
+// Rewrites path with the counters every interval seconds, for ever.  The file
+// is written next to path and renamed over it so readers never see half of it.
+static void dump_stats(std::function<void(stats_snapshot&)> collect,
+        const std::string& path, int interval)
+{
+    for (;;)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(interval));
+        stats_snapshot snapshot;
+        collect(snapshot);
+
+        if (path == "-")
+        {
+            snapshot.write(std::cout);
+            std::cout.flush();
+            continue;
+        }
+
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp.c_str());
+            snapshot.write(out);
+            if (!out)
+            {
+                std::cout << "error writing stats to " << tmp << '\n';
+                continue;
+            }
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+            std::cout << "error renaming stats file to " << path << '\n';
+    }
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 2 && argc != 3)
+    send_limits limits;
+    std::string puzzle_dir;
+    int threads = 1;
+    int tick = 0;
+    std::string stats_path;
+    int stats_every = 10;
+    std::string journal_path;
+    int snapshot_every = 300;
+    std::string record_path;
+    std::string replay_path;
+    double speed = 1;
+    int wait = 0;
+    bool nodelay = true;
+    int room_idle = 600;
+    int room_keep = 86400;
+    long max_rooms = 10000;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
     {
-        std::cout << "usage: " << argv[0] << " crossword_file [port]\n";
-        return -1;
+        std::string arg = argv[i];
+        if (arg[0] != '-')
+        {
+            args.push_back(arg);
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "-dir")
+            puzzle_dir = value;
+        else if (arg == "-threads")
+            threads = atoi(value.c_str());
+        else if (arg == "-tick")
+            tick = atoi(value.c_str());
+        else if (arg == "-low")
+            limits.low_watermark = atol(value.c_str());
+        else if (arg == "-high")
+            limits.high_watermark = atol(value.c_str());
+        else if (arg == "-drop")
+            limits.drop_limit = atol(value.c_str());
+        else if (arg == "-stats")
+            stats_path = value;
+        else if (arg == "-stats-every")
+            stats_every = std::max(1, atoi(value.c_str()));
+        else if (arg == "-journal")
+            journal_path = value;
+        else if (arg == "-snapshot")
+            snapshot_every = atoi(value.c_str());
+        else if (arg == "-record")
+            record_path = value;
+        else if (arg == "-replay")
+            replay_path = value;
+        else if (arg == "-speed")
+            speed = atof(value.c_str());
+        else if (arg == "-wait")
+            wait = atoi(value.c_str());
+        else if (arg == "-nodelay")
+            nodelay = atoi(value.c_str()) != 0;
+        else if (arg == "-idle")
+            room_idle = atoi(value.c_str());
+        else if (arg == "-keep")
+            room_keep = atoi(value.c_str());
+        else if (arg == "-rooms")
+            max_rooms = std::max(0L, atol(value.c_str()));
+        else
+        {
+            usage(argv[0]);
+            return -1;
+        }
     }
 
-    std::ifstream infile(argv[1]);
-    if (!infile)
+    // With a puzzle directory the default puzzle is optional, a lone number
+    // is the port
+    if (!puzzle_dir.empty() && args.size() == 1 &&
+            args[0].find_first_not_of("0123456789") == std::string::npos)
+        args.insert(args.begin(), "");
+
+    if ((args.size() < 1 && puzzle_dir.empty()) || args.size() > 2)
     {
-        std::cout << "error opening file " << argv[1] << '\n';
+        usage(argv[0]);
         return -1;
     }
 
+    puzzle_library puzzles(puzzle_dir);
+    if (!args.empty() && !args[0].empty())
+    {
+        if (!puzzles.set_default(args[0]))
+        {
+            std::cout << "error opening file " << args[0] << '\n';
+            return -1;
+        }
+    }
+
     std::string port;
-    if (argc == 3)
-        port = argv[2];
+    if (args.size() == 2)
+        port = args[1];
     else
         port = CROSSWORD_PORT;
 
     kissnet::init_networking();
 
-    crossword_server serv(infile, port);
-    std::cout << "Starting server\n";
-    serv.run();
+    std::unique_ptr<move_journal> journal;
+    std::map<std::string, crossword_room*> recovered;
+    if (!journal_path.empty())
+    {
+        try
+        {
+            journal.reset(new move_journal(journal_path));
+            long records = journal->recover(puzzles, recovered);
+            std::cout << "Replayed " << records << " journal records into "
+                << recovered.size() << " rooms\n";
+            journal->set_snapshot_every(snapshot_every);
+        }
+        catch (std::exception& e)
+        {
+            std::cout << e.what() << '\n';
+            return -1;
+        }
+    }
+
+    std::unique_ptr<game_recorder> recorder;
+    std::unique_ptr<game_replay> replay;
+    try
+    {
+        if (!record_path.empty())
+            recorder.reset(new game_recorder(record_path));
+        if (!replay_path.empty())
+        {
+            replay.reset(new game_replay(replay_path, speed));
+            std::cout << "Loaded " << replay->size() << " recorded messages\n";
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << e.what() << '\n';
+        return -1;
+    }
+
+    // The ghost players of a replay live in one loop, which must then own
+    // every room
+    if (threads == 1 || replay)
+    {
+        crossword_server serv(puzzles, port, limits);
+        serv.set_cursor_tick(tick);
+        serv.set_nodelay(nodelay);
+        serv.set_room_limits(room_idle, max_rooms, room_keep);
+        serv.set_journal(journal.get());
+        serv.restore_rooms(recovered);
+        serv.set_recorder(recorder.get());
+        serv.set_replay(replay.get(), wait);
+        if (!stats_path.empty())
+        {
+            std::thread(dump_stats, [&serv](stats_snapshot& snapshot) {
+                        snapshot.add(serv.stats()); }, stats_path, stats_every).detach();
+        }
+        std::cout << "Starting server\n";
+        serv.run();
+    }
+    else
+    {
+        server_pool pool(puzzles, port, limits, threads);
+        pool.set_cursor_tick(tick);
+        pool.set_nodelay(nodelay);
+        pool.set_room_limits(room_idle, max_rooms, room_keep);
+        pool.set_journal(journal.get());
+        pool.restore_rooms(recovered);
+        pool.set_recorder(recorder.get());
+        if (!stats_path.empty())
+        {
+            std::thread(dump_stats, [&pool](stats_snapshot& snapshot) {
+                        pool.collect_stats(snapshot); }, stats_path, stats_every).detach();
+        }
+        std::cout << "Starting server with " << pool.size() << " event loops\n";
+        pool.run();
+    }
 
     return 0;
 }
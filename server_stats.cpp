@@ -0,0 +1,210 @@
+#include "server_stats.h"
+
+// The loop's own thread is the only writer, relaxed ordering is enough for
+// readers that just want a recent value
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+/// Names of the message types, in type byte order
+static const char *message_names[server_stats::message_types] = {
+    "unknown", "board_request", "board", "update", "cursor", "win", "pause",
+    "solve_word", "solve_letter", "binary_board", "update_batch", "cursor_batch",
+    "board_patch"
+};
+
+/// Creates an empty histogram
+stats_histogram::stats_histogram()
+{
+    for (int i = 0; i < buckets; i++)
+        counts_[i].store(0, relaxed);
+    sum_.store(0, relaxed);
+}
+
+/**
+ * Counts one sample.
+ * @param value The sample, anything over 2^31 goes in the last bucket.
+ */
+void stats_histogram::record(unsigned long value)
+{
+    int bucket = 0;
+    while (bucket < buckets - 1 && (1UL << bucket) < value)
+        bucket++;
+
+    counts_[bucket].fetch_add(1, relaxed);
+    sum_.fetch_add(value, relaxed);
+}
+
+unsigned long stats_histogram::count(int bucket) const
+{
+    return counts_[bucket].load(relaxed);
+}
+
+unsigned long stats_histogram::sum() const
+{
+    return sum_.load(relaxed);
+}
+
+/// Creates zeroed counters
+server_stats::server_stats()
+{
+    for (int i = 0; i < message_types; i++)
+    {
+        messages_in[i].store(0, relaxed);
+        messages_out[i].store(0, relaxed);
+    }
+    bytes_in.store(0, relaxed);
+    bytes_queued.store(0, relaxed);
+    bytes_out.store(0, relaxed);
+    send_calls.store(0, relaxed);
+    accepted.store(0, relaxed);
+    disconnects.store(0, relaxed);
+    dropped.store(0, relaxed);
+    players.store(0, relaxed);
+    rooms.store(0, relaxed);
+}
+
+/**
+ * Counts a message read from a player, its bytes are counted as they are read.
+ * @param type The type byte, without the extended header flag.
+ */
+void server_stats::count_in(int type)
+{
+    if (type < 0 || type >= message_types)
+        type = 0;
+    messages_in[type].fetch_add(1, relaxed);
+}
+
+/**
+ * Counts a packet queued for a player.
+ * @param type The type byte, without the extended header flag.
+ * @param bytes The size of the packet including its header.
+ */
+void server_stats::count_out(int type, size_t bytes, unsigned long copies)
+{
+    if (type < 0 || type >= message_types)
+        type = 0;
+    messages_out[type].fetch_add(copies, relaxed);
+    bytes_queued.fetch_add(bytes * copies, relaxed);
+}
+
+unsigned long usec_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+/// Creates a snapshot with everything zero
+stats_snapshot::stats_snapshot()
+: bytes_in(0), bytes_queued(0), bytes_out(0), send_calls(0), accepted(0), disconnects(0),
+    dropped(0), players(0), rooms(0)
+{
+    for (int i = 0; i < server_stats::message_types; i++)
+    {
+        messages_in[i] = 0;
+        messages_out[i] = 0;
+    }
+    histogram *hists[] = { &loop_usec, &fanout_usec, &queue_bytes };
+    for (int h = 0; h < 3; h++)
+    {
+        for (int i = 0; i < stats_histogram::buckets; i++)
+            hists[h]->counts[i] = 0;
+        hists[h]->sum = 0;
+    }
+}
+
+static void add_histogram(stats_snapshot::histogram& to, const stats_histogram& from)
+{
+    for (int i = 0; i < stats_histogram::buckets; i++)
+        to.counts[i] += from.count(i);
+    to.sum += from.sum();
+}
+
+/**
+ * Adds a server's counters to the snapshot.  The server may be running, each
+ * value is read once but they are not read at the same instant.
+ * @param stats The server's counters.
+ */
+void stats_snapshot::add(const server_stats& stats)
+{
+    for (int i = 0; i < server_stats::message_types; i++)
+    {
+        messages_in[i] += stats.messages_in[i].load(relaxed);
+        messages_out[i] += stats.messages_out[i].load(relaxed);
+    }
+    bytes_in += stats.bytes_in.load(relaxed);
+    bytes_queued += stats.bytes_queued.load(relaxed);
+    bytes_out += stats.bytes_out.load(relaxed);
+    send_calls += stats.send_calls.load(relaxed);
+    accepted += stats.accepted.load(relaxed);
+    disconnects += stats.disconnects.load(relaxed);
+    dropped += stats.dropped.load(relaxed);
+    players += stats.players.load(relaxed);
+    rooms += stats.rooms.load(relaxed);
+    add_histogram(loop_usec, stats.loop_usec);
+    add_histogram(fanout_usec, stats.fanout_usec);
+    add_histogram(queue_bytes, stats.queue_bytes);
+}
+
+static void write_value(std::ostream& out, const char *name, const char *type,
+        unsigned long value)
+{
+    out << "# TYPE crossword_" << name << ' ' << type << '\n'
+        << "crossword_" << name << ' ' << value << '\n';
+}
+
+static void write_histogram(std::ostream& out, const char *name,
+        const stats_snapshot::histogram& hist)
+{
+    // Buckets are cumulative, there is no point going past the last sample
+    int last = 0;
+    for (int i = 0; i < stats_histogram::buckets; i++)
+    {
+        if (hist.counts[i] > 0)
+            last = i;
+    }
+
+    out << "# TYPE crossword_" << name << " histogram\n";
+    unsigned long total = 0;
+    for (int i = 0; i <= last; i++)
+    {
+        total += hist.counts[i];
+        out << "crossword_" << name << "_bucket{le=\"" << (1UL << i) << "\"} "
+            << total << '\n';
+    }
+    out << "crossword_" << name << "_bucket{le=\"+Inf\"} " << total << '\n'
+        << "crossword_" << name << "_sum " << hist.sum << '\n'
+        << "crossword_" << name << "_count " << total << '\n';
+}
+
+/**
+ * Writes the snapshot in the Prometheus text exposition format.
+ * @param out The stream to write to.
+ */
+void stats_snapshot::write(std::ostream& out) const
+{
+    out << "# TYPE crossword_messages_in_total counter\n";
+    for (int i = 0; i < server_stats::message_types; i++)
+    {
+        out << "crossword_messages_in_total{type=\"" << message_names[i] << "\"} "
+            << messages_in[i] << '\n';
+    }
+    out << "# TYPE crossword_messages_out_total counter\n";
+    for (int i = 0; i < server_stats::message_types; i++)
+    {
+        out << "crossword_messages_out_total{type=\"" << message_names[i] << "\"} "
+            << messages_out[i] << '\n';
+    }
+
+    write_value(out, "bytes_in_total", "counter", bytes_in);
+    write_value(out, "bytes_queued_total", "counter", bytes_queued);
+    write_value(out, "bytes_out_total", "counter", bytes_out);
+    write_value(out, "send_calls_total", "counter", send_calls);
+    write_value(out, "accepted_total", "counter", accepted);
+    write_value(out, "disconnects_total", "counter", disconnects);
+    write_value(out, "dropped_total", "counter", dropped);
+    write_value(out, "players", "gauge", players);
+    write_value(out, "rooms", "gauge", rooms);
+
+    write_histogram(out, "loop_usec", loop_usec);
+    write_histogram(out, "fanout_usec", fanout_usec);
+    write_histogram(out, "queue_bytes", queue_bytes);
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstddef>
+
+// Counters kept by one event loop.  Only the loop's own thread writes them,
+// any other thread may read them at any time without locking, so a stats dump
+// never holds up the loop.  All values are totals since the server started
+// except players and rooms, which are the current counts.
+
+// Counts of samples in power of two buckets, bucket i has the samples that
+// are at most 2^i.  Samples are microseconds or bytes.
+class stats_histogram
+{
+public:
+    static const int buckets = 32;
+
+    stats_histogram();
+
+    void record(unsigned long value);
+
+    unsigned long count(int bucket) const;
+    unsigned long sum() const;
+
+private:
+    // Not copyable
+    stats_histogram(const stats_histogram&);
+    stats_histogram& operator=(const stats_histogram&);
+
+    std::atomic<unsigned long> counts_[buckets];
+    std::atomic<unsigned long> sum_;
+};
+
+struct server_stats
+{
+    // Message types are counted by their type byte, anything past the last
+    // known type lands in the unknown slot 0
+    static const int message_types = 13;
+
+    server_stats();
+
+    void count_in(int type);
+    // copies is the number of players the same packet is queued for
+    void count_out(int type, size_t bytes, unsigned long copies = 1);
+
+    std::atomic<unsigned long> messages_in[message_types];
+    std::atomic<unsigned long> messages_out[message_types];
+    // Bytes read from sockets, and queued for sending / actually written
+    std::atomic<unsigned long> bytes_in;
+    std::atomic<unsigned long> bytes_queued;
+    std::atomic<unsigned long> bytes_out;
+    // System calls made writing to players' sockets
+    std::atomic<unsigned long> send_calls;
+
+    std::atomic<unsigned long> accepted;
+    std::atomic<unsigned long> disconnects;
+    // Players dropped for falling past the drop limit
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> players;
+    std::atomic<unsigned long> rooms;
+
+    // Time spent handling each batch of events, not counting the wait
+    stats_histogram loop_usec;
+    // Time taken to queue one packet (or one batch of updates) for a room
+    stats_histogram fanout_usec;
+    // Bytes left queued for a player after each flush
+    stats_histogram queue_bytes;
+
+private:
+    // Not copyable
+    server_stats(const server_stats&);
+    server_stats& operator=(const server_stats&);
+};
+
+// Microseconds since start, for the histograms
+unsigned long usec_since(std::chrono::steady_clock::time_point start);
+
+// A plain copy of the counters of any number of servers added together
+struct stats_snapshot
+{
+    stats_snapshot();
+
+    void add(const server_stats& stats);
+    // Writes the counters in the Prometheus text format, one value per line
+    void write(std::ostream& out) const;
+
+    unsigned long messages_in[server_stats::message_types];
+    unsigned long messages_out[server_stats::message_types];
+    unsigned long bytes_in, bytes_queued, bytes_out, send_calls;
+    unsigned long accepted, disconnects, dropped;
+    unsigned long players, rooms;
+
+    struct histogram
+    {
+        unsigned long counts[stats_histogram::buckets];
+        unsigned long sum;
+    };
+    histogram loop_usec, fanout_usec, queue_bytes;
+};